@@ -0,0 +1,624 @@
+#include "arith.h"
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vars.h"
+
+/* Slots of the cache of parsed expressions. */
+#define ARITH_CACHE_BUCKETS 256
+/* Cached expressions, the cache is emptied when there would be more. */
+#define ARITH_CACHE_MAX 1024
+/* Length of a parse error message. */
+#define ARITH_ERR_LEN 64
+
+typedef enum {
+	OP_NUM,
+	OP_VAR,
+	OP_NEG,
+	OP_NOT,
+	OP_BITNOT,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_ADD,
+	OP_SUB,
+	OP_SHL,
+	OP_SHR,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	OP_EQ,
+	OP_NE,
+	OP_BITAND,
+	OP_XOR,
+	OP_BITOR,
+	OP_AND,
+	OP_OR,
+	OP_COND,
+	OP_ASSIGN,
+	OP_COMMA
+} arith_op;
+
+/* Node of a parsed expression. */
+typedef struct node_tag {
+	arith_op op;
+	/* Operator of a compound assignment, OP_ASSIGN for '='. */
+	arith_op assign_op;
+	/* Value of OP_NUM. */
+	int64_t num;
+	/* Variable of OP_VAR and OP_ASSIGN, digits for a positional parameter,
+	 * '#' for their number.
+	 * */
+	char *name;
+	/* Operands, the condition of OP_COND first. */
+	struct node_tag *args[3];
+} node;
+
+/* Operators, longer first so that they match first. */
+static const char *const operators[] = {
+	"<<=", ">>=", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "*=", "/=",
+	"%=",  "+=",  "-=", "&=", "^=", "|=", "*",	"/",  "%",	"+",  "-",	"<",
+	">",   "&",	  "^",	"|",  "!",	"~",  "=",	"?",  ":",	",",  "(",	")"};
+
+/* Binary operators, higher precedence binds tighter. */
+static const struct {
+	const char *str;
+	arith_op op;
+	int prec;
+} binary_ops[] = {
+	{"||", OP_OR, 1},	  {"&&", OP_AND, 2},	{"|", OP_BITOR, 3},
+	{"^", OP_XOR, 4},	  {"&", OP_BITAND, 5},	{"==", OP_EQ, 6},
+	{"!=", OP_NE, 6},	  {"<", OP_LT, 7},		{"<=", OP_LE, 7},
+	{">", OP_GT, 7},	  {">=", OP_GE, 7},		{"<<", OP_SHL, 8},
+	{">>", OP_SHR, 8},	  {"+", OP_ADD, 9},		{"-", OP_SUB, 9},
+	{"*", OP_MUL, 10},	  {"/", OP_DIV, 10},	{"%", OP_MOD, 10}};
+
+static const struct {
+	const char *str;
+	arith_op op;
+} assign_ops[] = {{"=", OP_ASSIGN},	 {"*=", OP_MUL},	{"/=", OP_DIV},
+				  {"%=", OP_MOD},	 {"+=", OP_ADD},	{"-=", OP_SUB},
+				  {"<<=", OP_SHL},	 {">>=", OP_SHR},	{"&=", OP_BITAND},
+				  {"^=", OP_XOR},	 {"|=", OP_BITOR}};
+
+typedef enum { T_END, T_NUM, T_NAME, T_OP } token_kind;
+
+/* State of the parser, the current token is the next one to be used. */
+typedef struct {
+	/* Rest of the expression after the token. */
+	const char *pos;
+	token_kind kind;
+	int64_t num;
+	/* Operator, or start of the name of 'len' characters. */
+	const char *str;
+	size_t len;
+	/* The first error, empty if there is none. */
+	char err[ARITH_ERR_LEN];
+} parser;
+
+/* One cached expression. */
+typedef struct cached_tag {
+	char *text;
+	node *root;
+	struct cached_tag *next;
+} cached;
+
+static struct {
+	cached *buckets[ARITH_CACHE_BUCKETS];
+	size_t count;
+} cache;
+
+static void
+node_free(node *n) {
+	if (!n)
+		return;
+	for (int i = 0; i < 3; ++i)
+		node_free(n->args[i]);
+	free(n->name);
+	free(n);
+}
+
+/* Parses integer constant at 'str' like C does, the rest of digits and
+ * letters must be empty. Returns the end of it, NULL if it is invalid.
+ * */
+static const char *
+parse_number(const char *str, int64_t *num) {
+	char *end;
+	errno = 0;
+	/* Unsigned, so that it wraps around like the arithmetic. */
+	*num = (int64_t)strtoull(str, &end, 0);
+	if (end == str || errno == ERANGE || (*end >= '0' && *end <= '9') ||
+		*end == '_' || (*end >= 'a' && *end <= 'z') ||
+		(*end >= 'A' && *end <= 'Z'))
+		return NULL;
+	return end;
+}
+
+static void
+parse_error(parser *ps, const char *msg) {
+	if (ps->err[0] == '\0')
+		snprintf(ps->err, sizeof ps->err, "%s", msg);
+	ps->kind = T_END;
+}
+
+/* Returns length of the name or positional parameter at 'str'. */
+static size_t
+name_len(const char *str) {
+	if (*str >= '0' && *str <= '9')
+		return strspn(str, "0123456789");
+	size_t len = 0;
+	while (vars_valid_name(str, len + 1))
+		++len;
+	return len;
+}
+
+/* Moves to the next token. */
+static void
+next_token(parser *ps) {
+	if (ps->err[0] != '\0')
+		return;
+	const char *p = ps->pos + strspn(ps->pos, " \t\n");
+	if (*p == '\0') {
+		ps->kind = T_END;
+		ps->pos = p;
+		return;
+	}
+	if (*p >= '0' && *p <= '9') {
+		ps->kind = T_NUM;
+		if (!(ps->pos = parse_number(p, &ps->num)))
+			parse_error(ps, "invalid number");
+		return;
+	}
+	if (p[0] == '$' && p[1] == '#') {
+		ps->kind = T_NAME;
+		ps->str = p + 1;
+		ps->len = 1;
+		ps->pos = p + 2;
+		return;
+	}
+	if (*p == '$') {
+		bool braced = *++p == '{';
+		ps->str = p + braced;
+		ps->len = name_len(ps->str);
+		p = ps->str + ps->len;
+		if (ps->len == 0 || (braced && *p++ != '}')) {
+			parse_error(ps, "invalid variable");
+			return;
+		}
+		ps->kind = T_NAME;
+		ps->pos = p;
+		return;
+	}
+	if ((ps->len = name_len(p)) > 0) {
+		ps->kind = T_NAME;
+		ps->str = p;
+		ps->pos = p + ps->len;
+		return;
+	}
+	for (size_t i = 0; i < sizeof operators / sizeof *operators; ++i) {
+		size_t len = strlen(operators[i]);
+		if (strncmp(p, operators[i], len) == 0) {
+			ps->kind = T_OP;
+			ps->str = operators[i];
+			ps->pos = p + len;
+			return;
+		}
+	}
+	parse_error(ps, "unexpected character");
+}
+
+/* Whether the current token is operator 'op'. */
+static bool
+token_is(const parser *ps, const char *op) {
+	return ps->kind == T_OP && strcmp(ps->str, op) == 0;
+}
+
+static node *
+new_node(arith_op op, node *a, node *b, node *c) {
+	node *n = calloc(1, sizeof *n);
+	if (!n)
+		err(1, "malloc");
+	n->op = op;
+	n->assign_op = OP_ASSIGN;
+	n->args[0] = a;
+	n->args[1] = b;
+	n->args[2] = c;
+	return n;
+}
+
+/* Computes the operator of a unary or binary operation. Returns false after
+ * reporting division by zero in 'expr', unless it is NULL.
+ * */
+static bool
+apply(arith_op op, int64_t l, int64_t r, int64_t *res, const char *expr) {
+	uint64_t ul = l, ur = r;
+	switch (op) {
+	case OP_NEG:
+		*res = (int64_t)(0 - ul);
+		return true;
+	case OP_NOT:
+		*res = !l;
+		return true;
+	case OP_BITNOT:
+		*res = ~l;
+		return true;
+	case OP_MUL:
+		*res = (int64_t)(ul * ur);
+		return true;
+	case OP_DIV:
+	case OP_MOD:
+		if (r == 0) {
+			if (expr)
+				warnx("$((%s)): division by zero.", expr);
+			return false;
+		}
+		/* INT64_MIN / -1 wraps around too. */
+		if (r == -1)
+			*res = op == OP_DIV ? (int64_t)(0 - ul) : 0;
+		else
+			*res = op == OP_DIV ? l / r : l % r;
+		return true;
+	case OP_ADD:
+		*res = (int64_t)(ul + ur);
+		return true;
+	case OP_SUB:
+		*res = (int64_t)(ul - ur);
+		return true;
+	case OP_SHL:
+		*res = (int64_t)(ul << (r & 63));
+		return true;
+	case OP_SHR:
+		*res = l >> (r & 63);
+		return true;
+	case OP_LT:
+		*res = l < r;
+		return true;
+	case OP_LE:
+		*res = l <= r;
+		return true;
+	case OP_GT:
+		*res = l > r;
+		return true;
+	case OP_GE:
+		*res = l >= r;
+		return true;
+	case OP_EQ:
+		*res = l == r;
+		return true;
+	case OP_NE:
+		*res = l != r;
+		return true;
+	case OP_BITAND:
+		*res = l & r;
+		return true;
+	case OP_XOR:
+		*res = l ^ r;
+		return true;
+	case OP_BITOR:
+		*res = l | r;
+		return true;
+	case OP_AND:
+		*res = l && r;
+		return true;
+	case OP_OR:
+		*res = l || r;
+		return true;
+	case OP_NUM:
+	case OP_VAR:
+	case OP_COND:
+	case OP_ASSIGN:
+	case OP_COMMA:
+		break;
+	}
+	assert(false);
+	return false;
+}
+
+/* Whether 'op' has one operand. */
+static bool
+is_unary(arith_op op) {
+	return op == OP_NEG || op == OP_NOT || op == OP_BITNOT;
+}
+
+/* Replaces 'n' by its value if it is constant, or by the operand which
+ * decides it. Returns the resulting node.
+ * */
+static node *
+fold(node *n) {
+	node *a = n->args[0], *b = n->args[1];
+	if (n->op == OP_VAR || n->op == OP_ASSIGN || !a || a->op != OP_NUM)
+		return n;
+	node *keep = NULL;
+	int64_t val;
+	if (n->op == OP_COND)
+		keep = a->num ? b : n->args[2];
+	else if (n->op == OP_COMMA)
+		/* Constants have no side effects. */
+		keep = b;
+	else if ((n->op == OP_AND && !a->num) || (n->op == OP_OR && a->num)) {
+		/* The other operand is never evaluated. */
+		a->num = n->op == OP_OR;
+		keep = a;
+	} else if ((is_unary(n->op) || (b && b->op == OP_NUM)) &&
+			   apply(n->op, a->num, b ? b->num : 0, &val, NULL)) {
+		keep = new_node(OP_NUM, NULL, NULL, NULL);
+		keep->num = val;
+	}
+	if (!keep)
+		return n;
+	for (int i = 0; i < 3; ++i)
+		if (n->args[i] == keep)
+			n->args[i] = NULL;
+	node_free(n);
+	return keep;
+}
+
+static node *
+parse_comma(parser *ps);
+
+static node *
+parse_assign(parser *ps);
+
+static node *
+parse_unary(parser *ps);
+
+static node *
+parse_primary(parser *ps) {
+	node *n = NULL;
+	if (ps->kind == T_NUM) {
+		n = new_node(OP_NUM, NULL, NULL, NULL);
+		n->num = ps->num;
+		next_token(ps);
+	} else if (ps->kind == T_NAME) {
+		n = new_node(OP_VAR, NULL, NULL, NULL);
+		if (!(n->name = strndup(ps->str, ps->len)))
+			err(1, "malloc");
+		next_token(ps);
+	} else if (token_is(ps, "(")) {
+		next_token(ps);
+		n = parse_comma(ps);
+		if (!token_is(ps, ")"))
+			parse_error(ps, "missing ')'");
+		next_token(ps);
+	} else
+		parse_error(ps, ps->kind == T_END ? "missing operand"
+										  : "unexpected operator");
+	return n;
+}
+
+static node *
+parse_unary(parser *ps) {
+	static const struct {
+		const char *str;
+		arith_op op;
+	} unary_ops[] = {{"-", OP_NEG}, {"!", OP_NOT}, {"~", OP_BITNOT}};
+	if (token_is(ps, "+")) {
+		next_token(ps);
+		return parse_unary(ps);
+	}
+	for (size_t i = 0; i < sizeof unary_ops / sizeof *unary_ops; ++i)
+		if (token_is(ps, unary_ops[i].str)) {
+			next_token(ps);
+			return fold(new_node(unary_ops[i].op, parse_unary(ps), NULL, NULL));
+		}
+	return parse_primary(ps);
+}
+
+/* Parses operators of at least 'min_prec' precedence, left associative. */
+static node *
+parse_binary(parser *ps, int min_prec) {
+	node *left = parse_unary(ps);
+	while (ps->kind == T_OP) {
+		size_t i = 0;
+		while (i < sizeof binary_ops / sizeof *binary_ops &&
+			   strcmp(binary_ops[i].str, ps->str) != 0)
+			++i;
+		if (i == sizeof binary_ops / sizeof *binary_ops ||
+			binary_ops[i].prec < min_prec)
+			break;
+		next_token(ps);
+		node *right = parse_binary(ps, binary_ops[i].prec + 1);
+		left = fold(new_node(binary_ops[i].op, left, right, NULL));
+	}
+	return left;
+}
+
+static node *
+parse_cond(parser *ps) {
+	node *cond = parse_binary(ps, 1);
+	if (!token_is(ps, "?"))
+		return cond;
+	next_token(ps);
+	node *then = parse_comma(ps);
+	if (!token_is(ps, ":"))
+		parse_error(ps, "missing ':'");
+	next_token(ps);
+	return fold(new_node(OP_COND, cond, then, parse_cond(ps)));
+}
+
+static node *
+parse_assign(parser *ps) {
+	if (ps->kind != T_NAME || !vars_valid_name(ps->str, ps->len))
+		return parse_cond(ps);
+	parser name = *ps;
+	next_token(ps);
+	for (size_t i = 0; ps->kind == T_OP && i < sizeof assign_ops /
+													   sizeof *assign_ops;
+		 ++i)
+		if (strcmp(assign_ops[i].str, ps->str) == 0) {
+			next_token(ps);
+			node *n = new_node(OP_ASSIGN, parse_assign(ps), NULL, NULL);
+			n->assign_op = assign_ops[i].op;
+			if (!(n->name = strndup(name.str, name.len)))
+				err(1, "malloc");
+			return n;
+		}
+	/* Not an assignment, the name is parsed again. */
+	*ps = name;
+	return parse_cond(ps);
+}
+
+static node *
+parse_comma(parser *ps) {
+	node *n = parse_assign(ps);
+	while (token_is(ps, ",")) {
+		next_token(ps);
+		n = fold(new_node(OP_COMMA, n, parse_assign(ps), NULL));
+	}
+	return n;
+}
+
+/* Returns the parsed expression, NULL after reporting a syntax error. */
+static node *
+parse(const char *expr) {
+	parser ps = {expr, T_END, 0, NULL, 0, ""};
+	next_token(&ps);
+	node *root = parse_comma(&ps);
+	if (ps.err[0] == '\0' && ps.kind != T_END)
+		parse_error(&ps, ps.kind == T_OP && strcmp(ps.str, ")") == 0
+							 ? "unmatched ')'"
+							 : "missing operator");
+	if (ps.err[0] != '\0') {
+		warnx("$((%s)): %s.", expr, ps.err);
+		node_free(root);
+		return NULL;
+	}
+	return root;
+}
+
+/* Reads value of the variable, positional parameter or '#' 'name'. Returns
+ * false after reporting that it is not a number in 'expr'.
+ * */
+static bool
+read_var(const char *name, int64_t *val, const char *expr) {
+	const char *str;
+	if (*name == '#') {
+		size_t count;
+		vars_args(&count);
+		*val = count;
+		return true;
+	} else if (*name >= '0' && *name <= '9') {
+		size_t count;
+		char *const *args = vars_args(&count);
+		size_t i = strtoul(name, NULL, 10);
+		str = i >= 1 && i <= count ? args[i - 1] : NULL;
+	} else
+		str = vars_get(name);
+	if (str)
+		str += strspn(str, " \t\n");
+	if (!str || *str == '\0') {
+		*val = 0;
+		return true;
+	}
+	bool neg = *str == '-';
+	const char *end = parse_number(str + (neg || *str == '+'), val);
+	if (!end || end[strspn(end, " \t\n")] != '\0') {
+		warnx("$((%s)): %s: \"%s\" is not a number.", expr, name, str);
+		return false;
+	}
+	if (neg)
+		*val = (int64_t)(0 - (uint64_t)*val);
+	return true;
+}
+
+/* Evaluates the parsed 'expr'. */
+static bool
+eval(const node *n, int64_t *res, const char *expr) {
+	int64_t l, r = 0;
+	if (n->op == OP_NUM) {
+		*res = n->num;
+		return true;
+	} else if (n->op == OP_VAR)
+		return read_var(n->name, res, expr);
+	else if (n->op == OP_COND)
+		return eval(n->args[0], &l, expr) &&
+			   eval(n->args[l ? 1 : 2], res, expr);
+	else if (n->op == OP_COMMA)
+		return eval(n->args[0], &l, expr) && eval(n->args[1], res, expr);
+	else if (n->op == OP_ASSIGN) {
+		if (!eval(n->args[0], &r, expr))
+			return false;
+		if (n->assign_op == OP_ASSIGN)
+			*res = r;
+		else if (!read_var(n->name, &l, expr) ||
+				 !apply(n->assign_op, l, r, res, expr))
+			return false;
+		char str[24];
+		snprintf(str, sizeof str, "%lld", (long long)*res);
+		vars_set(n->name, str, false);
+		return true;
+	}
+	if (!eval(n->args[0], &l, expr))
+		return false;
+	/* Short circuit. */
+	if ((n->op == OP_AND && !l) || (n->op == OP_OR && l)) {
+		*res = n->op == OP_OR;
+		return true;
+	}
+	if (!is_unary(n->op) && !eval(n->args[1], &r, expr))
+		return false;
+	return apply(n->op, l, r, res, expr);
+}
+
+/* FNV-1a hash of the expression. */
+static uint64_t
+hash_text(const char *text) {
+	uint64_t hash = 14695981039346656037ull;
+	for (; *text; ++text) {
+		hash ^= (unsigned char)*text;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static void
+cache_clear() {
+	for (size_t i = 0; i < ARITH_CACHE_BUCKETS; ++i)
+		while (cache.buckets[i]) {
+			cached *c = cache.buckets[i];
+			cache.buckets[i] = c->next;
+			free(c->text);
+			node_free(c->root);
+			free(c);
+		}
+	cache.count = 0;
+}
+
+/* Returns the parsed expression from the cache, it is parsed and cached if
+ * needed. Returns NULL after reporting a syntax error.
+ * */
+static const node *
+cache_get(const char *expr) {
+	cached **bucket = &cache.buckets[hash_text(expr) % ARITH_CACHE_BUCKETS];
+	for (cached *c = *bucket; c; c = c->next)
+		if (strcmp(c->text, expr) == 0)
+			return c->root;
+	node *root = parse(expr);
+	if (!root)
+		return NULL;
+	if (cache.count >= ARITH_CACHE_MAX)
+		cache_clear();
+	cached *c = malloc(sizeof *c);
+	if (!c || !(c->text = strdup(expr)))
+		err(1, "malloc");
+	c->root = root;
+	c->next = *bucket;
+	*bucket = c;
+	++cache.count;
+	return root;
+}
+
+bool
+arith_eval(const char *expr, int64_t *result) {
+	assert(expr);
+	assert(result);
+
+	const node *root = cache_get(expr);
+	return root && eval(root, result, expr);
+}
@@ -0,0 +1,23 @@
+#ifndef MYSHELL_ARITH_HEADER
+#define MYSHELL_ARITH_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Arithmetic expansion '$((expr))'.
+ *
+ * Expressions use 64-bit signed integers which wrap around, C operators with
+ * C precedence including assignments, '?:' and ',', and decimal, 0x hex and
+ * 0 octal constants. 'NAME', '$NAME' and '${NAME}' refer to variables whose
+ * values must be integers, unset and empty ones are 0. '$N' refers to
+ * a positional parameter and '$#' to their number. Each distinct expression
+ * is parsed once into a tree with constant subexpressions folded, which is
+ * cached and evaluated in the shell.
+ * */
+
+/* Evaluates 'expr' into *result. Returns false after reporting a syntax
+ * error, division by zero or a variable which is not a number.
+ * */
+bool
+arith_eval(const char *expr, int64_t *result);
+#endif /* ifndef MYSHELL_ARITH_HEADER */
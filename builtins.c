@@ -0,0 +1,366 @@
+#include "builtins.h"
+
+#include <assert.h>
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "funcs.h"
+#include "jobs.h"
+#include "rlimits.h"
+#include "run_script.h"
+#include "stats.h"
+#include "vars.h"
+
+/* Executes internal cd command according to the passed info.
+ * Argv must be valid and argv[0] must be "cd".
+ * */
+static void
+exec_cd(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+	assert(strncmp("cd", argv[0], 3) == 0);
+
+	/* "cd" goes to home directory.
+	 * "cd -" goes to the last directory.
+	 * "cd dir" goes to the 'dir' directory.
+	 * */
+	const char *newPWD;
+	const char *arg = argv[1];
+	if (arg == NULL) {
+		newPWD = vars_get("HOME");
+		if (newPWD == NULL)
+			errx(1, "cd: HOME not set.");
+	} else if (argv[2] != NULL) {
+		errx(1, "cd: too many arguments.");
+	} else /* One arg = new PWD */
+	{
+		if (strncmp("-", arg, 2) == 0) {
+			const char *old = vars_get("OLDPWD");
+			if (old == NULL)
+				errx(1, "cd: OLDPWD not set.");
+			newPWD = old;
+		} else
+			newPWD = arg;
+	}
+
+	if (chdir(newPWD) == -1)
+		err(1, "Failed to change curr. dir (chdir).");
+	/* newPWD might be OLDPWD's value which is replaced. */
+	char *pwd = strdup(newPWD);
+	if (!pwd)
+		err(1, "malloc");
+	const char *currPWD = vars_get("PWD");
+	if (currPWD)
+		vars_set("OLDPWD", currPWD, true);
+	vars_set("PWD", pwd, true);
+	free(pwd);
+	*exval = 0;
+}
+
+/* Executes the exit command = exits programx with *exval value.
+ * *exval must be valid and argv[0] must be "exit".
+ * */
+static void
+exec_exit(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+	assert(strncmp("exit", argv[0], 5) == 0);
+
+	if (argv[1] != NULL)
+		errx(1, "exit: too many arguments.");
+	exit(*exval);
+}
+
+/* Prints latency statistics of the shell.
+ * argv[0] must be "stats".
+ * */
+static void
+exec_stats(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+	assert(strncmp("stats", argv[0], 6) == 0);
+
+	if (argv[1] != NULL) {
+		warnx("stats: too many arguments.");
+		*exval = 2;
+		return;
+	}
+	stats_print(STDOUT_FILENO);
+	*exval = 0;
+}
+
+/* Exports variables, "NAME=value" also sets them. Without arguments lists
+ * the exported variables. argv[0] must be "export".
+ * */
+static void
+exec_export(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+	assert(strncmp("export", argv[0], 7) == 0);
+
+	*exval = 0;
+	if (argv[1] == NULL)
+		vars_print_exported(STDOUT_FILENO);
+	for (char **arg = argv + 1; *arg; ++arg)
+		if (vars_is_assign(*arg))
+			vars_assign(*arg, true);
+		else if (vars_valid_name(*arg, strlen(*arg)))
+			vars_export(*arg);
+		else {
+			warnx("export: \"%s\": not a valid identifier.", *arg);
+			*exval = 1;
+		}
+}
+
+/* Removes variables, functions after "-f". argv[0] must be "unset". */
+static void
+exec_unset(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+	assert(strncmp("unset", argv[0], 6) == 0);
+
+	*exval = 0;
+	if (argv[1] && strcmp(argv[1], "-f") == 0) {
+		for (char **arg = argv + 2; *arg; ++arg)
+			funcs_remove(*arg, false);
+		return;
+	}
+	for (char **arg = argv + 1; *arg; ++arg)
+		if (vars_valid_name(*arg, strlen(*arg)))
+			vars_unset(*arg);
+		else {
+			warnx("unset: \"%s\": not a valid identifier.", *arg);
+			*exval = 1;
+		}
+}
+
+/* Defines alias by "name=value words..." arguments, the value is the rest
+ * of the arguments joined by spaces. Names alone print their aliases, no
+ * arguments print all of them. argv[0] must be "alias".
+ * */
+static void
+exec_alias(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+	assert(strncmp("alias", argv[0], 6) == 0);
+
+	*exval = 0;
+	if (argv[1] == NULL) {
+		funcs_print_aliases(STDOUT_FILENO, NULL);
+		return;
+	}
+	const char *eq = strchr(argv[1], '=');
+	if (!eq) {
+		for (char **arg = argv + 1; *arg; ++arg)
+			if (!funcs_print_aliases(STDOUT_FILENO, *arg)) {
+				warnx("alias: %s: not found.", *arg);
+				*exval = 1;
+			}
+		return;
+	}
+	if (eq == argv[1]) {
+		warnx("alias: \"%s\": invalid name.", argv[1]);
+		*exval = 1;
+		return;
+	}
+	size_t len = 1;
+	for (char **arg = argv + 1; *arg; ++arg)
+		len += strlen(*arg) + 1;
+	char *name = malloc(len);
+	if (!name)
+		err(1, "malloc");
+	/* "name\0value words..." */
+	size_t pos = 0;
+	for (char **arg = argv + 1; *arg; ++arg)
+		pos += sprintf(name + pos, arg == argv + 1 ? "%s" : " %s", *arg);
+	name[eq - argv[1]] = '\0';
+	if (!funcs_alias(name, name + (eq - argv[1]) + 1))
+		*exval = 2;
+	free(name);
+}
+
+/* Removes aliases. argv[0] must be "unalias". */
+static void
+exec_unalias(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+	assert(strncmp("unalias", argv[0], 8) == 0);
+
+	*exval = 0;
+	for (char **arg = argv + 1; *arg; ++arg)
+		if (!funcs_remove(*arg, true)) {
+			warnx("unalias: %s: not found.", *arg);
+			*exval = 1;
+		}
+}
+
+/* Prints the arguments separated by spaces. "-n" as the first argument
+ * omits the trailing newline. argv[0] must be "echo".
+ * */
+static void
+exec_echo(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+	assert(strncmp("echo", argv[0], 5) == 0);
+
+	char **arg = argv + 1;
+	bool newline = !(*arg && strcmp(*arg, "-n") == 0);
+	if (!newline)
+		++arg;
+	size_t len = 0;
+	for (char **a = arg; *a; ++a)
+		len += strlen(*a) + 1;
+	/* One write for the whole line. */
+	char *line = malloc(len + 1);
+	if (!line)
+		err(1, "malloc");
+	size_t pos = 0;
+	for (char **a = arg; *a; ++a) {
+		size_t a_len = strlen(*a);
+		memcpy(line + pos, *a, a_len);
+		pos += a_len;
+		line[pos++] = ' ';
+	}
+	if (pos > 0)
+		--pos;
+	if (newline)
+		line[pos++] = '\n';
+	*exval = write(STDOUT_FILENO, line, pos) == (ssize_t)pos ? 0 : 1;
+	free(line);
+}
+
+/* Continues a job, in foreground for "fg", in background for "bg".
+ * Without arguments the current job is continued. argv[0] must be one of
+ * them.
+ * */
+static void
+exec_fg_bg(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+
+	*exval = 1;
+	if (argv[1] != NULL && argv[2] != NULL) {
+		warnx("%s: too many arguments.", argv[0]);
+		return;
+	}
+	int id = jobs_find(argv[1]);
+	if (id == -1) {
+		warnx("%s: %s: no such job.", argv[0], argv[1] ? argv[1] : "current");
+		return;
+	}
+	*exval = job_continue(id, strcmp(argv[0], "fg") == 0);
+}
+
+/* Lists the stopped and background jobs. argv[0] must be "jobs". */
+static void
+exec_jobs(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+	assert(strncmp("jobs", argv[0], 5) == 0);
+
+	*exval = 0;
+	jobs_print(STDOUT_FILENO);
+}
+
+/* Sets the shell's resource limits, inherited by all commands, by
+ * "[-S] [-H] -X value..." options. "[-S|-H] -X" prints one limit, soft by
+ * default, "-a" prints all of them and no option prints the file size limit.
+ * Followed by a command the options only limit it, see strip_ulimit().
+ * argv[0] must be "ulimit".
+ * */
+static void
+exec_ulimit(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+	assert(strncmp("ulimit", argv[0], 7) == 0);
+
+	*exval = 0;
+	char **arg = argv + 1;
+	bool hard = false;
+	if (*arg && (strcmp(*arg, "-S") == 0 || strcmp(*arg, "-H") == 0))
+		hard = (*arg++)[1] == 'H';
+	if (!*arg || !arg[1]) {
+		const char *opt = *arg ? *arg : "-f";
+		if (opt[0] == '-' && opt[1] != '\0' && opt[2] == '\0' &&
+			limits_print(STDOUT_FILENO, opt[1], hard))
+			return;
+	}
+	Limits lims = {0};
+	int parsed = limits_parse(argv + 1, &lims, true);
+	if (parsed == -1)
+		*exval = 2;
+	else if (argv[1 + parsed]) {
+		warnx("ulimit: unexpected argument \"%s\".", argv[1 + parsed]);
+		*exval = 2;
+	} else if (!limits_apply(&lims))
+		*exval = 1;
+}
+
+/* Runs a script in the shell by "source file args...", the arguments are its
+ * positional parameters. argv[0] must be "source" or ".".
+ * */
+static void
+exec_source(char **argv, int *exval) {
+	assert(argv);
+	assert(exval);
+
+	if (argv[1] == NULL) {
+		warnx("%s: missing file.", argv[0]);
+		*exval = 2;
+		return;
+	}
+	*exval = run_source(argv[1], argv + 2);
+}
+
+/* Table of all builtin commands. Pure ones do not change the shell's state,
+ * so their output can be captured without a child process.
+ * */
+static const struct {
+	const char *name;
+	builtin_fn fn;
+	bool pure;
+} builtins[] = {
+	{".", &exec_source, false},
+	{"alias", &exec_alias, false},
+	{"bg", &exec_fg_bg, false},
+	{"cd", &exec_cd, false},
+	{"echo", &exec_echo, true},
+	{"exit", &exec_exit, false},
+	{"export", &exec_export, false},
+	{"fg", &exec_fg_bg, false},
+	{"jobs", &exec_jobs, false},
+	{"source", &exec_source, false},
+	{"stats", &exec_stats, true},
+	{"ulimit", &exec_ulimit, false},
+	{"unalias", &exec_unalias, false},
+	{"unset", &exec_unset, false},
+};
+
+builtin_fn
+builtin_find(const char *name) {
+	assert(name);
+
+	for (size_t i = 0; i < sizeof builtins / sizeof *builtins; ++i)
+		if (strcmp(builtins[i].name, name) == 0)
+			return builtins[i].fn;
+	return NULL;
+}
+
+bool
+builtin_is_pure(const char *name) {
+	assert(name);
+
+	for (size_t i = 0; i < sizeof builtins / sizeof *builtins; ++i)
+		if (strcmp(builtins[i].name, name) == 0)
+			return builtins[i].pure;
+	return false;
+}
+
+const char *
+builtin_name(size_t i) {
+	return i < sizeof builtins / sizeof *builtins ? builtins[i].name : NULL;
+}
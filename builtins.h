@@ -0,0 +1,24 @@
+#ifndef MYSHELL_BUILTINS_HEADER
+#define MYSHELL_BUILTINS_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Internal command executed directly by the shell.
+ * 'argv' holds the expanded name and arguments and is NULL-terminated.
+ * Puts its exit value into *exval, both pointers are valid.
+ * */
+typedef void (*builtin_fn)(char **argv, int *exval);
+
+/* Returns builtin command called 'name' or NULL if there is none. */
+builtin_fn
+builtin_find(const char *name);
+
+/* Whether the builtin 'name' leaves the shell's state unchanged. */
+bool
+builtin_is_pure(const char *name);
+
+/* Returns name of the i-th builtin or NULL if there are fewer builtins. */
+const char *
+builtin_name(size_t i);
+#endif /* ifndef MYSHELL_BUILTINS_HEADER */
@@ -1,98 +1,189 @@
+#define _GNU_SOURCE /* execvpe, environ, sigabbrev_np */
 #include "cmdexecution.h"
 
 #include <assert.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
-#include <readline/history.h>
-#include <readline/readline.h>
+#include <sys/mman.h>
 #include <sys/queue.h>
 #include <sys/wait.h>
 
+#include "builtins.h"
+#include "cmdparsing.h"
+#include "expand.h"
+#include "funcs.h"
+#include "jobs.h"
+#include "rlimits.h"
 #include "signals.h"
+#include "vars.h"
+
+/* Size of reads of a captured output. */
+#define CAPTURE_BLOCK (64 * 1024)
+/* Requested buffer size of the pipe with a captured output. */
+#define CAPTURE_PIPE_SIZE (1024 * 1024)
+/* Delay of SIGKILL after a deadline's signal. */
+#define TIMEOUT_KILL_AFTER_NS (10 * 1000 * 1000 * 1000ull)
+/* Nested function calls, deeper recursion fails instead of the stack. */
+#define FUNC_MAX_DEPTH 1000
+/* Room of ARG_MAX left for the kernel and the loader, like xargs(1) does. */
+#define BATCH_HEADROOM 2048
+
+static int
+cmp_fds(const void *l, const void *r) {
+	return *(const int *)l - *(const int *)r;
+}
 
-/* Executes internal cd command according to the passed info.
- * Cmd must be valid cmd and cmd->name must be "cd".
+/* Closes all descriptors above stderr except the sorted 'keep' ones.
+ * Everything the shell itself opened is close-on-exec already, this also
+ * sheds inherited and leaked descriptors. The cost does not depend on the
+ * number of open descriptors.
  * */
 static void
-exec_cd(CmdSimple *cmd) {
-	assert(cmd);
-	assert(strncmp("cd", cmd->name, 3) == 0);
-
-	/* "cd" goes to home directory.
-	 * "cd -" goes to the last directory.
-	 * "cd dir" goes to the 'dir' directory.
-	 * */
-	const char *newPWD;
-	CmdArg *arg = STAILQ_FIRST(&cmd->args);
-	if (arg == NULL) {
-		newPWD = getenv("HOME");
-		if (newPWD == NULL)
-			errx(1, "cd: HOME not set.");
-	} else if (STAILQ_NEXT(arg, tailq) != NULL) {
-		errx(1, "cd: too many arguments.");
-	} else /* One arg = new PWD */
-	{
-		assert(arg->val);
-		if (strncmp("-", arg->val, 2) == 0) {
-			const char *old = getenv("OLDPWD");
-			if (old == NULL)
-				errx(1, "cd: OLDPWD not set.");
-			newPWD = old;
-		} else
-			newPWD = arg->val;
+close_other_fds(const int *keep, size_t num_keep) {
+	unsigned int from = STDERR_FILENO + 1;
+	for (size_t i = 0; i < num_keep; ++i) {
+		if ((unsigned int)keep[i] > from)
+			close_range(from, keep[i] - 1, 0);
+		if ((unsigned int)keep[i] >= from)
+			from = keep[i] + 1;
 	}
-
-	const char *currPWD = getenv("PWD");
-	if (currPWD && setenv("OLDPWD", currPWD, 1) == -1)
-		err(1, "Failed to set OLDPWD env. variable.");
-	if (setenv("PWD", newPWD, 1) == -1)
-		err(1, "Failed to set PWD varible.");
-	if (chdir(newPWD) == -1)
-		err(1, "Failed to change curr. dir (chdir).");
+	close_range(from, ~0u, 0);
 }
 
-/* Executes the exit command = exits programx with *exval value.
- * *exval must be valid and cmd->name must be "exit".
+/* Process substitutions passed to the function calls in progress, commands
+ * of their bodies inherit them.
+ * */
+static struct {
+	int *fds;
+	size_t count;
+	size_t cap;
+} call_fds;
+
+/* Runs body of the function with the expanded command's arguments as the
+ * positional parameters and its assignments exported meanwhile. The body
+ * is kept alive even if the function is redefined by itself.
  * */
 static void
-exec_exit(CmdSimple *cmd, int *exval) {
-	assert(cmd);
-	assert(exval);
-	assert(strncmp("exit", cmd->name, 5) == 0);
-
-	if (!STAILQ_EMPTY(&cmd->args))
-		errx(1, "exit: too many arguments.");
-	exit(*exval);
+call_func(CmdFunc *func, CmdExpanded *exp, int *exval) {
+	static int depth = 0;
+	if (depth >= FUNC_MAX_DEPTH) {
+		warnx("%s: maximum function nesting exceeded.", func->name);
+		*exval = 1;
+		return;
+	}
+	++depth;
+	size_t outer_fds = call_fds.count;
+	if (call_fds.count + exp->num_procsubs > call_fds.cap) {
+		call_fds.cap = 2 * call_fds.cap + exp->num_procsubs;
+		call_fds.fds = realloc(call_fds.fds, call_fds.cap * sizeof(int));
+		if (!call_fds.fds)
+			err(1, "malloc");
+	}
+	for (size_t i = 0; i < exp->num_procsubs; ++i)
+		if (exp->procsubs[i].fd != -1)
+			call_fds.fds[call_fds.count++] = exp->procsubs[i].fd;
+	cmd_ref_func(func);
+	++func->running;
+	vars_push_temp(exp->assigns.items, exp->assigns.count);
+	vars_push_args(exp->argv.items + 1, exp->argv.count - 1);
+	exec_cmds(func->body, exval);
+	vars_pop_args();
+	vars_pop_temp();
+	--func->running;
+	cmd_unref_func(func);
+	call_fds.count = outer_fds;
+	--depth;
 }
 
-/* Replaces current process with the passed command and its arguments or exits
- * with error.
+/* Replaces current process with the expanded command or exits with error.
+ * The command's assignments are exported to it. Command without a name
+ * only exits, a function runs in the process and exits with its value.
  * */
 static void
-exec_simple(char *cmd, CmdArgs *cmd_args) {
-	assert(cmd);
-	assert(cmd_args);
-
-	int num_args = 0;
-	CmdArg *arg;
-	STAILQ_FOREACH(arg, cmd_args, tailq) { ++num_args; }
-	/* Allocate an array for the new args + program's name + ending NULL. */
-	char **args = malloc((num_args + 2) * sizeof *args);
-	if (!args)
+exec_simple(CmdExpanded *exp) {
+	assert(exp);
+
+	if (exp->argv.count == 0)
+		exit(0);
+	CmdFunc *func = funcs_find(exp->argv.items[0]);
+	if (func) {
+		int exval = 0;
+		call_func(func, exp, &exval);
+		exit(exval);
+	}
+	/* Process substitutions are passed as /dev/fd/N. */
+	size_t num_keep = exp->num_procsubs + call_fds.count;
+	int *keep = malloc((num_keep + 1) * sizeof *keep);
+	if (!keep)
 		err(1, "malloc");
-	args[0] = cmd;
-	args[num_args + 1] = NULL;
-	int i = 0;
-	STAILQ_FOREACH(arg, cmd_args, tailq) { args[++i] = arg->val; }
-	assert(i == num_args);
+	for (size_t i = 0; i < exp->num_procsubs; ++i)
+		keep[i] = exp->procsubs[i].fd;
+	if (call_fds.count)
+		memcpy(keep + exp->num_procsubs, call_fds.fds,
+			   call_fds.count * sizeof *keep);
+	for (size_t i = 0; i < num_keep; ++i)
+		if (fcntl(keep[i], F_SETFD, 0) == -1)
+			err(1, "fcntl");
+	qsort(keep, num_keep, sizeof *keep, &cmp_fds);
+	close_other_fds(keep, num_keep);
+	free(keep);
+	for (size_t i = 0; i < exp->assigns.count; ++i)
+		vars_assign(exp->assigns.items[i], true);
+	char **envp = vars_envp();
+	sig_restore();
+	/* execvpe() searches PATH of environ, not of the passed envp. */
+	environ = envp;
+	execvpe(exp->argv.items[0], exp->argv.items, envp);
+	err(127, "%s", exp->argv.items[0]);
+}
+
+/* Writes whole 'buf' of 'len' bytes into 'fd' or exits with error. */
+static void
+write_all(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(fd, buf, len);
+		if (written == -1 && errno != EINTR)
+			err(1, "Cannot write here-document. (write)");
+		if (written > 0) {
+			buf += written;
+			len -= written;
+		}
+	}
+}
 
-	execvp(cmd, args);
-	err(127, "%s", cmd);
+/* Returns readable descriptor with the here-document's contents.
+ * Contents which fit into a pipe's buffer are written into a pipe, the rest
+ * into a sealed memfd, so no temporary files are needed.
+ * */
+static int
+open_here(const char *here) {
+	size_t len = strlen(here);
+	if (len <= PIPE_BUF) {
+		int fds[2];
+		if (pipe2(fds, O_CLOEXEC) == -1)
+			err(1, "Cannot create here-document. (pipe)");
+		write_all(fds[1], here, len);
+		close(fds[1]);
+		return fds[0];
+	}
+	int fd = memfd_create("here-document", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1)
+		err(1, "Cannot create here-document. (memfd_create)");
+	write_all(fd, here, len);
+	int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+	if (fcntl(fd, F_ADD_SEALS, seals) == -1)
+		err(1, "Cannot seal here-document. (fcntl)");
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		err(1, "Cannot rewind here-document. (lseek)");
+	return fd;
 }
 
 /* Replaces standard IO with IOs in io argument if there are any.
@@ -102,9 +193,14 @@ static void
 set_IO(const CmdIO *io) {
 	assert(io);
 
-	if (io->in) {
+	if (io->here) {
+		int in_fd = open_here(io->here);
+		if (dup2(in_fd, STDIN_FILENO) == -1)
+			err(1, "Cannot redirect command's input. (dup2)");
+		close(in_fd);
+	} else if (io->in) {
 		int in_fd;
-		if ((in_fd = open(io->in, O_RDONLY)) == -1)
+		if ((in_fd = open(io->in, O_RDONLY | O_CLOEXEC)) == -1)
 			err(1, "Cannot open \"%s\". (open)", io->in);
 		if (dup2(in_fd, STDIN_FILENO) == -1)
 			err(1, "Cannot redirect command's input. (dup2)");
@@ -112,7 +208,7 @@ set_IO(const CmdIO *io) {
 	}
 	if (io->out) {
 		int out_fd;
-		int flags = O_WRONLY | O_CREAT;
+		int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
 		flags |= io->app ? O_APPEND : O_TRUNC;
 		if ((out_fd = open(io->out, flags, 0664)) == -1)
 			err(1, "Cannot open \"%s\". (open)", io->out);
@@ -122,69 +218,438 @@ set_IO(const CmdIO *io) {
 	}
 }
 
-/* Accepts exstatus received from wait() call and assign correct exit value to
- * the passed exval pointer. exval must be valid.
+/* Redirects the shell's own standard input and output by 'io' for
+ * a builtin or a function, the original descriptors are saved into 'saved',
+ * -1 if not redirected. Returns false after reporting a file which cannot
+ * be opened.
  * */
+static bool
+redirect_shell(const CmdIO *io, int saved[2]) {
+	int fds[2] = {-1, -1};
+	if (io->here)
+		fds[0] = open_here(io->here);
+	else if (io->in && (fds[0] = open(io->in, O_RDONLY | O_CLOEXEC)) == -1) {
+		warn("Cannot open \"%s\". (open)", io->in);
+		return false;
+	}
+	if (io->out) {
+		int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+		flags |= io->app ? O_APPEND : O_TRUNC;
+		if ((fds[1] = open(io->out, flags, 0664)) == -1) {
+			warn("Cannot open \"%s\". (open)", io->out);
+			if (fds[0] != -1)
+				close(fds[0]);
+			return false;
+		}
+	}
+	fflush(stdout);
+	for (int i = 0; i < 2; ++i) {
+		saved[i] = -1;
+		if (fds[i] == -1)
+			continue;
+		if ((saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 0)) == -1 ||
+			dup2(fds[i], i) == -1)
+			err(1, "Cannot redirect the shell's IO. (dup2)");
+		close(fds[i]);
+	}
+	return true;
+}
+
+/* Restores the descriptors saved by redirect_shell(). */
 static void
-child_exited(int exstatus, int *exval) {
-	assert(exval);
+restore_shell_io(int saved[2]) {
+	fflush(stdout);
+	for (int i = 0; i < 2; ++i)
+		if (saved[i] != -1) {
+			if (dup2(saved[i], i) == -1)
+				err(1, "Cannot restore the shell's IO. (dup2)");
+			close(saved[i]);
+		}
+}
 
-	if (WIFEXITED(exstatus))
-		*exval = WEXITSTATUS(exstatus);
-	else if (WIFSIGNALED(exstatus)) {
-		int sig = WTERMSIG(exstatus);
-		*exval = 128 + sig;
-		dprintf(STDERR_FILENO, "Killed by signal %d.\n", sig);
+/* Parses "N[.N][smhd]" duration, seconds by default, into nanoseconds.
+ * Returns false if it is invalid.
+ * */
+static bool
+parse_duration(const char *str, uint64_t *ns) {
+	char *end;
+	double val = strtod(str, &end);
+	if (end == str || !(val >= 0) || (*end != '\0' && end[1] != '\0'))
+		return false;
+	switch (*end) {
+	case '\0':
+	case 's':
+		break;
+	case 'm':
+		val *= 60;
+		break;
+	case 'h':
+		val *= 60 * 60;
+		break;
+	case 'd':
+		val *= 24 * 60 * 60;
+		break;
+	default:
+		return false;
 	}
+	/* Centuries are as good as forever. */
+	*ns = val < 1e10 ? val * 1e9 : 1e19;
+	return true;
 }
 
-/* Executes one simple command, puts its return value( if any ) into *exval.
- * Both pointers must be valid. The command is executed as child process
- * and the function waits for it.
+/* Returns signal given by its number, "TERM" or "SIGTERM" name or -1. */
+static int
+parse_signal(const char *str) {
+	char *end;
+	long num = strtol(str, &end, 10);
+	if (end != str && *end == '\0')
+		return num > 0 && num < NSIG ? num : -1;
+	if (strncasecmp(str, "SIG", 3) == 0)
+		str += 3;
+	for (int sig = 1; sig < NSIG; ++sig) {
+		const char *abbrev = sigabbrev_np(sig);
+		if (abbrev && strcasecmp(abbrev, str) == 0)
+			return sig;
+	}
+	return -1;
+}
+
+/* Limits the job being started by the shell-wide MYSH_TIMEOUT deadline.
+ * MYSH_TIMEOUT_SIGNAL and MYSH_TIMEOUT_KILL_AFTER override the signal and
+ * the delay of SIGKILL. Invalid values are ignored.
  * */
 static void
-exec_one(CmdSimple *cmd, int *exval) {
-	assert(exval);
-	assert(cmd);
+default_deadline() {
+	const char *val = vars_get("MYSH_TIMEOUT");
+	uint64_t ns;
+	if (!val || !parse_duration(val, &ns) || ns == 0)
+		return;
+	int sig = SIGTERM;
+	uint64_t kill_after = TIMEOUT_KILL_AFTER_NS;
+	if ((val = vars_get("MYSH_TIMEOUT_SIGNAL")) && parse_signal(val) != -1)
+		sig = parse_signal(val);
+	if ((val = vars_get("MYSH_TIMEOUT_KILL_AFTER")))
+		parse_duration(val, &kill_after);
+	job_deadline(ns, sig, kill_after);
+}
 
-	if (strncmp("exit", cmd->name, 5) == 0)
-		exec_exit(cmd, exval);
-	else if (strncmp("cd", cmd->name, 3) == 0) {
-		exec_cd(cmd);
-		*exval = 0;
-	} else {
-		int childID;
-		switch (childID = fork()) {
+/* Frees the first 'num' words of the command and removes them. */
+static void
+drop_words(CmdExpanded *exp, size_t num) {
+	ArgVec *argv = &exp->argv;
+	for (size_t i = 0; i < num; ++i)
+		free(argv->items[i]);
+	/* Including the terminating NULL. */
+	memmove(argv->items, argv->items + num,
+			(argv->count - num + 1) * sizeof *argv->items);
+	argv->count -= num;
+	exp->num_plain = exp->num_plain > num ? exp->num_plain - num : 0;
+	if (exp->num_plain_tail > argv->count)
+		exp->num_plain_tail = argv->count;
+}
+
+/* Removes "timeout [-s SIG] [-k DURATION] DURATION" prefix of the command
+ * and limits the job being started by the deadline. Like for timeout(1),
+ * zero DURATION means no limit. Returns false on invalid usage.
+ * */
+static bool
+strip_timeout(CmdExpanded *exp) {
+	ArgVec *argv = &exp->argv;
+	if (argv->count == 0 || strcmp(argv->items[0], "timeout") != 0)
+		return true;
+	int sig = SIGTERM;
+	uint64_t kill_after = TIMEOUT_KILL_AFTER_NS;
+	uint64_t ns;
+	size_t i = 1;
+	for (; i + 1 < argv->count && argv->items[i][0] == '-'; i += 2) {
+		const char *opt = argv->items[i];
+		const char *val = argv->items[i + 1];
+		if (strcmp(opt, "-s") == 0 && (sig = parse_signal(val)) != -1)
+			continue;
+		if (strcmp(opt, "-k") == 0 && parse_duration(val, &kill_after))
+			continue;
+		warnx("timeout: invalid option \"%s %s\".", opt, val);
+		return false;
+	}
+	if (i >= argv->count || !parse_duration(argv->items[i], &ns)) {
+		warnx("timeout: invalid duration.");
+		return false;
+	} else if (i + 1 >= argv->count) {
+		warnx("timeout: missing command.");
+		return false;
+	}
+	if (ns != 0)
+		job_deadline(ns, sig, kill_after);
+	drop_words(exp, i + 1);
+	return true;
+}
+
+/* Removes "ulimit -X value..." prefix of the command and sets the limits in
+ * each process of the job being started. Without a command it is left for
+ * the 'ulimit' builtin which sets the shell's own limits, and so is invalid
+ * usage which the builtin reports.
+ * */
+static void
+strip_ulimit(CmdExpanded *exp) {
+	ArgVec *argv = &exp->argv;
+	if (argv->count == 0 || strcmp(argv->items[0], "ulimit") != 0)
+		return;
+	Limits lims = {0};
+	int parsed = limits_parse(argv->items + 1, &lims, false);
+	if (parsed <= 0 || (size_t)parsed + 1 >= argv->count)
+		return;
+	job_limits(&lims);
+	drop_words(exp, parsed + 1);
+}
+
+/* Removes "timeout" and "ulimit" prefixes of the command in any order.
+ * Returns false on invalid usage.
+ * */
+static bool
+strip_prefixes(CmdExpanded *exp) {
+	size_t count;
+	do {
+		count = exp->argv.count;
+		if (!strip_timeout(exp))
+			return false;
+		strip_ulimit(exp);
+	} while (exp->argv.count != count);
+	return true;
+}
+
+/* Returns "cmd args | cmd args" description of the expanded stages. */
+static char *
+describe(const CmdExpanded *exps, int count) {
+	/* Words with a space before each but the first, " | " between stages
+	 * even without words and the terminating NUL.
+	 * */
+	size_t len = 1 + (count > 0 ? 3 * (count - 1) : 0);
+	for (int i = 0; i < count; ++i)
+		for (size_t j = 0; j < exps[i].argv.count; ++j)
+			len += strlen(exps[i].argv.items[j]) + 1;
+	char *desc = malloc(len);
+	if (!desc)
+		err(1, "malloc");
+	size_t pos = 0;
+	for (int i = 0; i < count; ++i) {
+		if (i > 0)
+			pos += sprintf(desc + pos, " | ");
+		for (size_t j = 0; j < exps[i].argv.count; ++j)
+			pos += sprintf(desc + pos, j > 0 ? " %s" : "%s",
+						   exps[i].argv.items[j]);
+	}
+	desc[pos] = '\0';
+	return desc;
+}
+
+/* Returns how many batches of a command whose arguments do not fit into one
+ * exec() may run at once. It is given by MYSH_BATCH of the command's
+ * assignments or of the shell, 0 means no batching.
+ * */
+static long
+batch_limit(const CmdExpanded *exp) {
+	const char *val = vars_get("MYSH_BATCH");
+	for (size_t i = 0; i < exp->assigns.count; ++i)
+		if (strncmp(exp->assigns.items[i], "MYSH_BATCH=", 11) == 0)
+			val = exp->assigns.items[i] + 11;
+	if (!val)
+		return 0;
+	char *end;
+	long limit = strtol(val, &end, 10);
+	return *end == '\0' && limit > 0 ? limit : 0;
+}
+
+/* Returns space of 'str' argument or environment entry in exec(). */
+static size_t
+exec_size(const char *str) {
+	return strlen(str) + 1 + sizeof(char *);
+}
+
+/* Splits the arguments between the first 'fixed' and the last 'tail' words
+ * into the fewest batches which fit into ARG_MAX together with those words
+ * and the environment. Returns argv indices where the 'num' batches end,
+ * NULL if the whole command fits.
+ * */
+static size_t *
+plan_batches(const CmdExpanded *exp, size_t fixed, size_t tail, size_t *num) {
+	const ArgVec *argv = &exp->argv;
+	size_t last = argv->count - tail;
+	size_t base = BATCH_HEADROOM;
+	for (char **e = vars_envp(); *e; ++e)
+		base += exec_size(*e);
+	/* They are exported to the command too. */
+	for (size_t i = 0; i < exp->assigns.count; ++i)
+		base += exec_size(exp->assigns.items[i]);
+	for (size_t i = 0; i < fixed; ++i)
+		base += exec_size(argv->items[i]);
+	for (size_t i = last; i < argv->count; ++i)
+		base += exec_size(argv->items[i]);
+	long arg_max = sysconf(_SC_ARG_MAX);
+	size_t budget = arg_max > 0 && (size_t)arg_max > base ? arg_max - base : 0;
+	size_t *ends = NULL;
+	size_t cap = 0, used = 0;
+	*num = 0;
+	for (size_t i = fixed; i <= last; ++i) {
+		size_t size = i < last ? exec_size(argv->items[i]) : 0;
+		/* Greedy filling gives the fewest batches. Each batch gets at least
+		 * one argument, even one which does not fit.
+		 * */
+		if (i < last && (used == 0 || used + size <= budget)) {
+			used += size;
+			continue;
+		}
+		if (*num == cap) {
+			cap = cap ? 2 * cap : 16;
+			if (!(ends = realloc(ends, cap * sizeof *ends)))
+				err(1, "malloc");
+		}
+		ends[(*num)++] = i;
+		used = size;
+	}
+	if (*num <= 1) {
+		free(ends);
+		return NULL;
+	}
+	return ends;
+}
+
+/* Starts the command once per batch of arguments ending at 'ends', each
+ * with the first 'fixed' and the last 'tail' words. At most 'limit' batches
+ * run at once. Returns PID of the last started one.
+ * */
+static pid_t
+start_batches(CmdExpanded *exp, size_t fixed, size_t tail, const size_t *ends,
+			  size_t num, long limit) {
+	/* Truncated once, the batches append. */
+	if (exp->io.out && !exp->io.app) {
+		int fd = open(exp->io.out, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					  0664);
+		/* Otherwise each batch reports the error. */
+		if (fd != -1)
+			close(fd);
+		exp->io.app = true;
+	}
+	job_batches();
+	pid_t last = -1;
+	size_t started = 0;
+	for (size_t start = fixed; started < num && job_throttle(limit);
+		 start = ends[started++]) {
+		pid_t pid;
+		switch (pid = fork()) {
 		case -1:
 			err(1, "fork");
 		case 0: /* Child */
-			set_IO(&cmd->io);
-			exec_simple(cmd->name, &cmd->args);
+			job_child();
+			set_IO(&exp->io);
+			/* Only pointers are moved, in the child's own copy. The batch
+			 * moves down, so it never overwrites the tail.
+			 * */
+			ArgVec *argv = &exp->argv;
+			size_t len = ends[started] - start;
+			memmove(argv->items + fixed, argv->items + start,
+					len * sizeof *argv->items);
+			memmove(argv->items + fixed + len,
+					argv->items + argv->count - tail,
+					tail * sizeof *argv->items);
+			argv->count = fixed + len + tail;
+			argv->items[argv->count] = NULL;
+			exec_simple(exp);
 			break;
 		default:
+			job_forked(pid, exp->argv.items[0]);
+			last = pid;
 			break;
 		}
-		int exstatus;
-		struct sigaction old_act;
-		int wstatus;
-		block_SIGINT(&old_act);
-		/* Wait for the child to exit. If the user interrupted, pass it
-		 * to the child. Repeat that until the child dies
-		 * NOTE: from my testing the C-c sends signal both to the parent and
-		 * the child even if the child has stdin redirected. So its probably
-		 * sent to whole process group. Not sure how reliable it is, so I'll
-		 * foward it to the child just to be sure.
-		 * */
-		while ((wstatus = wait(&exstatus)) == -1 && errno == EINTR)
-			if (kill(childID, SIGINT) == -1 && errno != ESRCH)
-				err(1, "kill");
-		set_SIGINT(&old_act);
+	}
+	if (started < num)
+		warnx("%s: %zu of %zu batches not started.", exp->argv.items[0],
+			  num - started, num);
+	return last;
+}
+
+/* Executes one simple command, puts its return value( if any ) into *exval.
+ * Both pointers must be valid. The command is executed as child process
+ * and the function waits for it. Functions and builtins run in the shell
+ * with its own IO redirected. Arguments which do not fit into one exec()
+ * are split into batches if MYSH_BATCH is set. Words typed literally before
+ * the first expanded one and after the last one are repeated in each batch,
+ * e.g. the options and the destination of "cp $(files) /dest".
+ * */
+static void
+exec_one(CmdSimple *cmd, int *exval) {
+	assert(exval);
+	assert(cmd);
 
-		if (wstatus == -1)
-			err(1, "wait");
-		else
-			child_exited(exstatus, exval);
+	CmdExpanded exp;
+	bool expanded = expand_cmd(cmd, *exval, &exp);
+	CmdFunc *func;
+	builtin_fn builtin;
+	int saved[2];
+	pid_t childID = -1;
+	if (!expanded)
+		*exval = 1;
+	else if (!strip_prefixes(&exp))
+		*exval = 125;
+	else if (exp.argv.count == 0) {
+		/* Only assignments, they stay in the shell. Like in POSIX shells
+		 * the command fails with its last command substitution.
+		 * */
+		for (size_t i = 0; i < exp.assigns.count; ++i)
+			vars_assign(exp.assigns.items[i], false);
+		*exval = exp.subst_exval != -1 ? exp.subst_exval : 0;
+	} else if ((func = funcs_find(exp.argv.items[0]))) {
+		if (redirect_shell(&exp.io, saved)) {
+			call_func(func, &exp, exval);
+			restore_shell_io(saved);
+		} else
+			*exval = 1;
+	} else if ((builtin = builtin_find(exp.argv.items[0]))) {
+		if (redirect_shell(&exp.io, saved)) {
+			vars_push_temp(exp.assigns.items, exp.assigns.count);
+			builtin(exp.argv.items, exval);
+			vars_pop_temp();
+			restore_shell_io(saved);
+		} else
+			*exval = 1;
+	} else {
+		long limit = batch_limit(&exp);
+		size_t fixed = exp.num_plain > 0 ? exp.num_plain : 1;
+		assert(fixed <= exp.argv.count);
+		size_t tail = exp.num_plain_tail;
+		/* The expanded words may have been dropped with a prefix. */
+		if (tail > exp.argv.count - fixed)
+			tail = exp.argv.count - fixed;
+		size_t num_batches;
+		size_t *ends =
+			limit ? plan_batches(&exp, fixed, tail, &num_batches) : NULL;
+		if (ends) {
+			childID =
+				start_batches(&exp, fixed, tail, ends, num_batches, limit);
+			free(ends);
+		} else
+			switch (childID = fork()) {
+			case -1:
+				err(1, "fork");
+			case 0: /* Child */
+				job_child();
+				set_IO(&exp.io);
+				exec_simple(&exp);
+				break;
+			default:
+				job_forked(childID, exp.argv.items[0]);
+				break;
+			}
+	}
+	expand_close_procsubs(&exp);
+	if (childID == -1)
+		/* Only process substitutions are waited for. */
+		job_run_fg(-1, NULL);
+	else {
+		char *desc = describe(&exp, 1);
+		*exval = job_exval(job_run_fg(childID, desc));
+		free(desc);
 	}
+	expand_free(&exp);
 }
 
 /* Replaces standard IO with passed file descriptors from a pipe.
@@ -204,40 +669,6 @@ set_pipe_IO(int read_end, int write_end) {
 	}
 }
 
-/* Whether SIGINT has been triggered during execution of a pipe command. */
-static bool pipe_interrupted = false;
-
-static void
-pipe_SIGINT_handler(int signum) {
-	(void)signum;
-	pipe_interrupted = true;
-}
-
-static void
-pipe_set_SIGINT(struct sigaction *old_act) {
-	struct sigaction act;
-	act.sa_handler = &pipe_SIGINT_handler;
-	act.sa_flags = 0;
-	sigemptyset(&act.sa_mask);
-	if (sigaction(SIGINT, &act, old_act) == -1)
-		err(1, "Cannot set pipe's  SIGINT(sigaction).");
-}
-
-static void
-pipe_clear_SIGINT(struct sigaction *old_act) {
-	if (sigaction(SIGINT, old_act, NULL) == -1)
-		err(1, "Cannot restore SIGINT(sigaction).");
-}
-
-/* Sends kill command to all children in passed array. */
-static void
-kill_children(int *child_pids, int num_children) {
-	assert(child_pids);
-
-	for (int i = 0; i < num_children; ++i)
-		kill(child_pids[i], SIGINT);
-}
-
 /* Closes pipe descriptors if they are not -1. */
 static void
 close_pipe(int pipe[2]) {
@@ -249,97 +680,102 @@ close_pipe(int pipe[2]) {
 			;
 }
 
-/* Executes piped command = creates child processes, pipes them together
- * and waits for them. *exval is return value of the last process in the pipe.
+/* Starts the expanded stages of the piped command connected by pipes.
+ * Returns PID of the last one.
  * */
-static void
-exec_pipe(PipeCmd *cmd, int *exval) {
-	assert(cmd);
-	assert(exval);
-
-	CmdSimple *c;
-	int num_cmds = 0;
-	STAILQ_FOREACH(c, &cmd->cmds, tailq) { ++num_cmds; }
-	int *child_pids = (int *)malloc(num_cmds * sizeof *child_pids);
-	if (!child_pids)
-		err(1, "malloc");
-
+static pid_t
+start_stages(PipeCmd *cmd, CmdExpanded *exps) {
 	int lpipe[2] = {-1, -1};
 	int rpipe[2] = {-1, -1};
 
-	pipe_interrupted = false;
-	struct sigaction old_act;
-	pipe_set_SIGINT(&old_act);
-
 	int cmds_started = 0;
+	pid_t last_pid = -1;
+	CmdSimple *c;
 	STAILQ_FOREACH(c, &cmd->cmds, tailq) {
 		/* Create another pipe if it's not the last cmd.  */
-		if (STAILQ_NEXT(c, tailq) != NULL && pipe(rpipe) == -1)
+		if (STAILQ_NEXT(c, tailq) != NULL && pipe2(rpipe, O_CLOEXEC) == -1)
 			err(1, "pipe");
+		CmdExpanded *exp = &exps[cmds_started];
 
-		switch (child_pids[cmds_started] = fork()) {
+		pid_t pid;
+		switch (pid = fork()) {
 		case -1:
-			if (errno != EINTR)
-				err(1, "Failed to create a child process.(fork)");
-			break;
+			err(1, "Failed to create a child process.(fork)");
 		case 0: /* Child */
-			pipe_clear_SIGINT(&old_act);
+			job_child();
 			set_pipe_IO(lpipe[0], rpipe[1]);
 			/* Close still open ends from the parent. */
 			int pipe[2] = {lpipe[1], rpipe[0]};
 			close_pipe(pipe);
 
-			set_IO(&c->io);
-			exec_simple(c->name, &c->args);
+			set_IO(&exp->io);
+			exec_simple(exp);
 			break;
 		default:
-			/* Only increment on successful fork.
-			 * Otherwise there was EINTR which is handled below and needs
-			 * correct number of actually created commands. */
+			job_forked(pid, exp->argv.count ? exp->argv.items[0] : NULL);
+			last_pid = pid;
 			++cmds_started;
 			break;
 		}
+		expand_close_procsubs(exp);
 		close_pipe(lpipe);
 		lpipe[0] = rpipe[0];
 		lpipe[1] = rpipe[1];
 		rpipe[0] = -1;
 		rpipe[1] = -1;
+	}
+	return last_pid;
+}
 
-		if (pipe_interrupted) {
-			close_pipe(lpipe);
-			/* Send first wave of signals. */
-			kill_children(child_pids, cmds_started);
+/* Executes piped command = creates child processes, pipes them together
+ * and waits for them. *exval is return value of the last process in the pipe.
+ * A deadline given by "timeout" prefix and limits given by "ulimit" prefix
+ * of any stage apply to all of them.
+ * */
+static void
+exec_pipe(PipeCmd *cmd, int *exval) {
+	assert(cmd);
+	assert(exval);
+
+	CmdSimple *c;
+	int num_cmds = 0;
+	STAILQ_FOREACH(c, &cmd->cmds, tailq) { ++num_cmds; }
+	/* Kept until the end, their process substitutions are reaped with the
+	 * children.
+	 * */
+	CmdExpanded *exps = malloc(num_cmds * sizeof *exps);
+	if (!exps)
+		err(1, "malloc");
+	/* All stages are expanded before any pipe exists, so that children of
+	 * substitutions do not keep the pipes open.
+	 * */
+	int cmds_expanded = 0;
+	/* Exit value of the pipeline which cannot start, 0 if it can. */
+	int failed = 0;
+	STAILQ_FOREACH(c, &cmd->cmds, tailq) {
+		CmdExpanded *exp = &exps[cmds_expanded++];
+		if (!expand_cmd(c, *exval, exp)) {
+			failed = 1;
 			break;
 		}
+		if (!failed && !strip_prefixes(exp))
+			failed = 125;
 	}
-	int exstatus, wstatus;
-	/* Will hold return value of the pipe if it finishes peacefully. */
-	int last_exstatus = 0;
-	/* Assert-only variable to ensure the last child exited. */
-	bool exstatus_set = false;
-	/* Wait for all the children. */
-	while (true) {
-		wstatus = wait(&exstatus);
-		if (wstatus == -1) {
-			if (errno == EINTR)
-				kill_children(child_pids, cmds_started);
-			else if (errno == ECHILD)
-				break;
-			else
-				err(1, "wait");
-		}
-		/* Last cmd exited.*/
-		else if (cmds_started == num_cmds &&
-				 wstatus == child_pids[num_cmds - 1]) {
-			exstatus_set = true;
-			last_exstatus = exstatus;
-		}
+
+	if (!failed) {
+		pid_t last_pid = start_stages(cmd, exps);
+		char *desc = describe(exps, cmds_expanded);
+		*exval = job_exval(job_run_fg(last_pid, desc));
+		free(desc);
+	} else {
+		for (int i = 0; i < cmds_expanded; ++i)
+			expand_close_procsubs(&exps[i]);
+		job_run_fg(-1, NULL);
+		*exval = failed;
 	}
-	pipe_clear_SIGINT(&old_act);
-	/* Last child must have exited if all the children did. */
-	assert(exstatus_set);
-	child_exited(last_exstatus, exval);
-	free(child_pids);
+	for (int i = 0; i < cmds_expanded; ++i)
+		expand_free(&exps[i]);
+	free(exps);
 }
 
 /* Executes a command either as exec_one or exec_pipe,
@@ -353,6 +789,9 @@ exec_cmd(PipeCmd *cmd, int *exval) {
 
 	CmdSimple *first = STAILQ_FIRST(&cmd->cmds);
 	assert(first);
+	/* Process substitutions are started by the expansion. */
+	job_begin();
+	default_deadline();
 	if (STAILQ_NEXT(first, tailq) == NULL) /* Only one cmd */
 		exec_one(first, exval);
 	else {
@@ -366,5 +805,209 @@ exec_cmds(Cmds *cmds, int *exval) {
 	assert(exval);
 
 	PipeCmd *cmd;
-	STAILQ_FOREACH(cmd, cmds, tailq) { exec_cmd(cmd, exval); }
+	STAILQ_FOREACH(cmd, cmds, tailq) {
+		/* Skipped commands are not even expanded. */
+		if ((cmd->cond == CMD_AND && *exval != 0) ||
+			(cmd->cond == CMD_OR && *exval == 0))
+			continue;
+		if (cmd->func) {
+			/* Calls run the body from the table. */
+			funcs_define(cmd->func);
+			*exval = 0;
+		} else
+			exec_cmd(cmd, exval);
+	}
+}
+
+/* Reads everything from 'fd' and returns it without the trailing newlines. */
+static char *
+read_output(int fd) {
+	size_t len = 0, cap = CAPTURE_BLOCK;
+	char *buf = malloc(cap + 1);
+	if (!buf)
+		err(1, "malloc");
+	while (true) {
+		if (cap - len < CAPTURE_BLOCK) {
+			cap *= 2;
+			if (!(buf = realloc(buf, cap + 1)))
+				err(1, "malloc");
+		}
+		ssize_t read_len = read(fd, buf + len, cap - len);
+		if (read_len == 0)
+			break;
+		else if (read_len > 0)
+			len += read_len;
+		else if (errno != EINTR)
+			err(1, "Cannot read command's output. (read)");
+	}
+	while (len > 0 && buf[len - 1] == '\n')
+		--len;
+	buf[len] = '\0';
+	return buf;
+}
+
+/* Runs the builtin in the shell with "$?" being *exval and returns its
+ * output, *exval is set to its exit value. The output is written into
+ * a memfd, so that it cannot block on a full pipe.
+ * */
+static char *
+capture_builtin(builtin_fn builtin, char **argv, int *exval) {
+	int fd = memfd_create("substitution", MFD_CLOEXEC);
+	if (fd == -1)
+		err(1, "Cannot capture output. (memfd_create)");
+	fflush(stdout);
+	int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+	if (saved_stdout == -1 || dup2(fd, STDOUT_FILENO) == -1)
+		err(1, "Cannot capture output. (dup2)");
+	builtin(argv, exval);
+	fflush(stdout);
+	if (dup2(saved_stdout, STDOUT_FILENO) == -1)
+		err(1, "Cannot restore output. (dup2)");
+	close(saved_stdout);
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		err(1, "Cannot rewind captured output. (lseek)");
+	char *output = read_output(fd);
+	close(fd);
+	return output;
+}
+
+/* Returns the command if 'cmds' consist of one pure builtin without
+ * redirections, which is not overridden by a function, NULL otherwise.
+ * */
+static CmdSimple *
+pure_builtin_cmd(Cmds *cmds) {
+	PipeCmd *pipe = STAILQ_FIRST(cmds);
+	if (!pipe || STAILQ_NEXT(pipe, tailq))
+		return NULL;
+	CmdSimple *cmd = STAILQ_FIRST(&pipe->cmds);
+	if (!cmd || STAILQ_NEXT(cmd, tailq) || cmd->io.in || cmd->io.out ||
+		cmd->io.here)
+		return NULL;
+	return builtin_is_pure(cmd->name) && !funcs_find(cmd->name) ? cmd : NULL;
+}
+
+/* Line source of a command substitution, here-documents have no body. */
+static char *
+no_lines(void *ctx) {
+	(void)ctx;
+	return NULL;
+}
+
+/* Parses commands of a substitution, prints the error and returns NULL if
+ * they are invalid.
+ * */
+static Cmds *
+parse_sub(const char *cmds_str) {
+	char *err_msg = NULL;
+	Cmds *cmds = parse_line_cached(cmds_str, &err_msg);
+	if (cmds && !parse_heredocs(cmds, &no_lines, NULL, &err_msg)) {
+		parse_release(cmds);
+		cmds = NULL;
+	}
+	if (!cmds) {
+		dprintf(STDERR_FILENO, "error: %s\n", err_msg);
+		free(err_msg);
+	}
+	return cmds;
+}
+
+char *
+exec_capture(const char *cmds_str, int exval, int *status) {
+	assert(cmds_str);
+	assert(status);
+
+	Cmds *cmds = parse_sub(cmds_str);
+	if (!cmds) {
+		*status = 2;
+		char *empty = strdup("");
+		if (!empty)
+			err(1, "malloc");
+		return empty;
+	}
+
+	char *output;
+	CmdSimple *cmd = pure_builtin_cmd(cmds);
+	if (cmd) {
+		CmdExpanded exp;
+		*status = exval;
+		if (expand_cmd(cmd, exval, &exp))
+			output = capture_builtin(builtin_find(cmd->name), exp.argv.items,
+									 status);
+		else {
+			*status = 1;
+			if (!(output = strdup("")))
+				err(1, "malloc");
+		}
+		expand_free(&exp);
+	} else {
+		int fds[2];
+		/* Other children must not inherit the write end or the output would
+		 * never end. */
+		if (pipe2(fds, O_CLOEXEC) == -1)
+			err(1, "pipe");
+		/* Fewer context switches for big outputs, best effort. */
+		fcntl(fds[0], F_SETPIPE_SZ, CAPTURE_PIPE_SIZE);
+		fflush(stdout);
+		pid_t child = fork();
+		switch (child) {
+		case -1:
+			err(1, "fork");
+		case 0: /* Child */
+			if (dup2(fds[1], STDOUT_FILENO) == -1)
+				err(1, "dup2");
+			int keep = sig_fd();
+			close_other_fds(&keep, 1);
+			jobs_forget();
+			exec_cmds(cmds, &exval);
+			exit(exval);
+		default:
+			break;
+		}
+		close(fds[1]);
+		output = read_output(fds[0]);
+		close(fds[0]);
+		int wstatus;
+		while (waitpid(child, &wstatus, 0) == -1 && errno == EINTR)
+			;
+		*status = job_exval(wstatus);
+	}
+	parse_release(cmds);
+	return output;
+}
+
+int
+exec_procsub(const char *cmds_str, bool writes, int exval, pid_t *pid) {
+	assert(cmds_str);
+	assert(pid);
+
+	int fds[2];
+	/* Only the command using the substitution inherits the shell's end. */
+	if (pipe2(fds, O_CLOEXEC) == -1)
+		err(1, "pipe");
+	int child_end = writes ? 0 : 1;
+	fflush(stdout);
+	switch (*pid = fork()) {
+	case -1:
+		err(1, "fork");
+	case 0: /* Child */
+		job_child();
+		if (dup2(fds[child_end], child_end) == -1)
+			err(1, "dup2");
+		/* The commands are not exec'd, so close-on-exec does not help.
+		 * Ends of the other substitutions and the shell's descriptors go
+		 * too, except for the signalfd which reads the child's own signals.
+		 * */
+		int keep = sig_fd();
+		close_other_fds(&keep, 1);
+		Cmds *cmds = parse_sub(cmds_str);
+		if (!cmds)
+			exit(2);
+		exec_cmds(cmds, &exval);
+		exit(exval);
+	default:
+		job_forked(*pid, NULL);
+		break;
+	}
+	close(fds[child_end]);
+	return fds[1 - child_end];
 }
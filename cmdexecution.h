@@ -1,6 +1,10 @@
 #ifndef MYSHELL_COMMAND_EXECUTION_HEADER
 #define MYSHELL_COMMAND_EXECUTION_HEADER
 
+#include <stdbool.h>
+
+#include <sys/types.h>
+
 #include "cmdhiearchy.h"
 
 /* Execute the list of commands and returns exit value of the last command
@@ -9,4 +13,22 @@
  * */
 void
 exec_cmds(Cmds *cmds, int *exval);
+
+/* Executes commands in 'cmds_str' and returns their output without the
+ * trailing newlines. The caller frees the string. 'exval' is their "$?"
+ * until they run a command, *status is set to their exit value.
+ * A single pure builtin is run by the shell itself, other commands by a
+ * child process.
+ * */
+char *
+exec_capture(const char *cmds_str, int exval, int *status);
+
+/* Starts commands in 'cmds_str' in a child process connected by a pipe.
+ * If 'writes' is set, the returned end writes into the commands' input,
+ * otherwise it reads their output. The end is close-on-exec.
+ * The child's pid is stored into 'pid'. 'exval' is the commands' "$?"
+ * until they run a command.
+ * */
+int
+exec_procsub(const char *cmds_str, bool writes, int exval, pid_t *pid);
 #endif
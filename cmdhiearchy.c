@@ -7,7 +7,7 @@
 
 CmdIO
 cmd_gen_IO() {
-	CmdIO io = {NULL, NULL, false};
+	CmdIO io = {NULL, NULL, false, NULL, NULL};
 	return io;
 }
 
@@ -16,10 +16,8 @@ cmd_add_IOs(CmdIO *from, CmdIO *to) {
 	assert(from);
 	assert(to);
 
-	if (from->in != NULL) {
-		free(to->in);
-		to->in = from->in;
-	}
+	if (from->in || from->here_end || from->here)
+		cmd_set_input(to, from->in, from->here_end, from->here);
 	if (from->out != NULL) {
 		free(to->out);
 		to->out = from->out;
@@ -27,6 +25,29 @@ cmd_add_IOs(CmdIO *from, CmdIO *to) {
 	}
 }
 
+void
+cmd_set_input(CmdIO *io, char *in, char *here_end, char *here) {
+	assert(io);
+	assert(!!in + !!here_end + !!here == 1);
+
+	free(io->in);
+	free(io->here_end);
+	free(io->here);
+	io->in = in;
+	io->here_end = here_end;
+	io->here = here;
+}
+
+void
+cmd_free_IO(CmdIO *io) {
+	assert(io);
+
+	free(io->in);
+	free(io->out);
+	free(io->here);
+	free(io->here_end);
+}
+
 CmdSimple *
 cmd_alloc_simple(char *name, CmdIO io) {
 	assert(name);
@@ -53,8 +74,7 @@ cmd_free_simple(CmdSimple *cmd) {
 	}
 
 	free((char *)cmd->name);
-	free(cmd->io.in);
-	free(cmd->io.out);
+	cmd_free_IO(&cmd->io);
 	free(cmd);
 }
 
@@ -85,9 +105,45 @@ cmd_alloc_pipe(CmdSimple *firstCmd) {
 		err(1, "malloc");
 	STAILQ_INIT(&cmd->cmds);
 	STAILQ_INSERT_TAIL(&cmd->cmds, firstCmd, tailq);
+	cmd->cond = CMD_ALWAYS;
+	cmd->func = NULL;
 	return cmd;
 }
 
+PipeCmd *
+cmd_alloc_funcdef(char *name, Cmds *body) {
+	assert(name);
+	assert(body);
+
+	PipeCmd *cmd = malloc(sizeof *cmd);
+	CmdFunc *func = malloc(sizeof *func);
+	if (!cmd || !func)
+		err(1, "malloc");
+	*func = (CmdFunc){name, body, NULL, 0, 1};
+	STAILQ_INIT(&cmd->cmds);
+	cmd->cond = CMD_ALWAYS;
+	cmd->func = func;
+	return cmd;
+}
+
+CmdFunc *
+cmd_ref_func(CmdFunc *func) {
+	assert(func);
+
+	++func->refs;
+	return func;
+}
+
+void
+cmd_unref_func(CmdFunc *func) {
+	if (!func || --func->refs > 0)
+		return;
+	free(func->name);
+	cmd_free_cmds(func->body);
+	free(func->alias);
+	free(func);
+}
+
 void
 cmd_free_pipe(PipeCmd *cmd) {
 	if (!cmd)
@@ -99,6 +155,7 @@ cmd_free_pipe(PipeCmd *cmd) {
 		cmd_free_simple(simple);
 		simple = next;
 	}
+	cmd_unref_func(cmd->func);
 	free(cmd);
 }
 
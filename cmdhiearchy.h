@@ -2,16 +2,22 @@
 #define MYSHELL_CMDHIEARCHY_HEADER
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include <sys/queue.h>
 
 /* Filenames to which redirect the input and output of a command.
  * App specifies whether the output should be appended or not.
+ * Here is the contents of a here-document or here-string fed to the input
+ * instead of 'in'. Here_end is the delimiter of a here-document whose body
+ * has not been read yet.
  * */
 typedef struct {
 	char *in;
 	char *out;
 	bool app;
+	char *here;
+	char *here_end;
 } CmdIO;
 
 /* A command arguments. */
@@ -36,16 +42,42 @@ typedef struct CmdSimple_tag {
 STAILQ_HEAD(CmdPipedCmds_tag, CmdSimple_tag);
 typedef struct CmdPipedCmds_tag CmdPipedCmds;
 
-/* One piped command. The list might contain only one command. */
+/* Whether a piped command runs depending on the exit value of the previous
+ * one. CMD_AND follows "&&" and runs after success, CMD_OR follows "||" and
+ * runs after failure.
+ * */
+typedef enum { CMD_ALWAYS, CMD_AND, CMD_OR } CmdCond;
+
+/* One piped command. The list might contain only one command. A function
+ * definition has no commands, it defines 'func' instead.
+ * */
 typedef struct PipeCmd_tag {
 	CmdPipedCmds cmds;
+	CmdCond cond;
+	struct CmdFunc_tag *func;
 	STAILQ_ENTRY(PipeCmd_tag) tailq;
 } PipeCmd;
 
-/* List of commands that were separated by semicolons. */
+/* List of commands that were separated by semicolons, "&&" or "||". They
+ * are executed left to right, so "&&" and "||" have equal precedence.
+ * */
 STAILQ_HEAD(Cmds_tag, PipeCmd_tag);
 typedef struct Cmds_tag Cmds;
 
+/* Function defined by "name() { cmds; }". It is shared by the definition
+ * and the table of functions, so it is counted and freed with the last
+ * reference.
+ * */
+typedef struct CmdFunc_tag {
+	char *name;
+	Cmds *body;
+	/* Original text of an alias, NULL for a function. */
+	char *alias;
+	/* Number of calls in progress. */
+	int running;
+	size_t refs;
+} CmdFunc;
+
 /* Returns initialized CmdIO structure that does not redirect any
  * inputs/outputs.
  * */
@@ -59,6 +91,17 @@ cmd_gen_IO();
 void
 cmd_add_IOs(CmdIO *from, CmdIO *to);
 
+/* Sets the input of 'io' to 'in' file, the here-document's delimiter
+ * 'here_end' or the here-string 'here'. Exactly one of them is non-NULL and
+ * it is claimed. The replaced input is deallocated.
+ * */
+void
+cmd_set_input(CmdIO *io, char *in, char *here_end, char *here);
+
+/* Frees strings of the redirections. */
+void
+cmd_free_IO(CmdIO *io);
+
 /* Generates CmdSimple with given name, IO and empty argument list. */
 CmdSimple *
 cmd_alloc_simple(char *name, CmdIO io);
@@ -88,6 +131,18 @@ cmd_alloc_pipe(CmdSimple *firstCmd);
 void
 cmd_free_pipe(PipeCmd *cmd);
 
+/* Allocates definition of function 'name' with 'body', both are claimed. */
+PipeCmd *
+cmd_alloc_funcdef(char *name, Cmds *body);
+
+/* Adds a reference to the function and returns it. */
+CmdFunc *
+cmd_ref_func(CmdFunc *func);
+
+/* Drops a reference to the function, the last one frees it. */
+void
+cmd_unref_func(CmdFunc *func);
+
 /* Allocates semicolon list of commands. */
 Cmds *
 cmd_alloc_cmds();
@@ -1,8 +1,9 @@
-/* A Bison parser, made by GNU Bison 3.0.4.  */
+/* A Bison parser, made by GNU Bison 3.8.2.  */
 
 /* Bison interface for Yacc-like parsers in C
 
-   Copyright (C) 1984, 1989-1990, 2000-2015 Free Software Foundation, Inc.
+   Copyright (C) 1984, 1989-1990, 2000-2015, 2018-2021 Free Software Foundation,
+   Inc.
 
    This program is free software: you can redistribute it and/or modify
    it under the terms of the GNU General Public License as published by
@@ -15,7 +16,7 @@
    GNU General Public License for more details.
 
    You should have received a copy of the GNU General Public License
-   along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
 
 /* As a special exception, you may create a larger work that contains
    part or all of the Bison parser skeleton and distribute that work
@@ -30,6 +31,10 @@
    This special exception was added by the Free Software Foundation in
    version 2.2 of Bison.  */
 
+/* DO NOT RELY ON FEATURES THAT ARE NOT DOCUMENTED in the manual,
+   especially those whose name start with YY_ or yy_.  They are
+   private implementation details that can be changed or removed.  */
+
 #ifndef YY_YY_CMDPARSER_H_INCLUDED
 # define YY_YY_CMDPARSER_H_INCLUDED
 /* Debug traces.  */
@@ -40,32 +45,44 @@
 extern int yydebug;
 #endif
 /* "%code requires" blocks.  */
-#line 15 "cmdparser.y" /* yacc.c:1909  */
+#line 17 "cmdparser.y"
 
 #include "cmdhiearchy.h"
 
-#line 48 "cmdparser.h" /* yacc.c:1909  */
+#line 53 "cmdparser.h"
 
-/* Token type.  */
+/* Token kinds.  */
 #ifndef YYTOKENTYPE
 # define YYTOKENTYPE
   enum yytokentype
   {
-    TOK_SCOLON = 258,
-    TOK_IO_IN = 259,
-    TOK_IO_OUT = 260,
-    TOK_IO_APP = 261,
-    TOK_PIPE = 262,
-    TOK_STR = 263
+    YYEMPTY = -2,
+    YYEOF = 0,                     /* "end of file"  */
+    YYerror = 256,                 /* error  */
+    YYUNDEF = 257,                 /* "invalid token"  */
+    TOK_SCOLON = 258,              /* ";"  */
+    TOK_IO_IN = 259,               /* "<"  */
+    TOK_IO_HEREDOC = 260,          /* "<<"  */
+    TOK_IO_HERESTR = 261,          /* "<<<"  */
+    TOK_IO_OUT = 262,              /* ">"  */
+    TOK_IO_APP = 263,              /* ">>"  */
+    TOK_PIPE = 264,                /* "|"  */
+    TOK_AND = 265,                 /* "&&"  */
+    TOK_OR = 266,                  /* "||"  */
+    TOK_LPAREN = 267,              /* "("  */
+    TOK_RPAREN = 268,              /* ")"  */
+    TOK_LBRACE = 269,              /* "{"  */
+    TOK_RBRACE = 270,              /* "}"  */
+    TOK_STR = 271                  /* "string"  */
   };
+  typedef enum yytokentype yytoken_kind_t;
 #endif
 
 /* Value type.  */
 #if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
-
 union YYSTYPE
 {
-#line 28 "cmdparser.y" /* yacc.c:1909  */
+#line 30 "cmdparser.y"
 
 	char *sval;
 	CmdSimple* simple;
@@ -73,9 +90,9 @@ union YYSTYPE
 	Cmds* cmds;
 	CmdIO io;
 
-#line 77 "cmdparser.h" /* yacc.c:1909  */
-};
+#line 94 "cmdparser.h"
 
+};
 typedef union YYSTYPE YYSTYPE;
 # define YYSTYPE_IS_TRIVIAL 1
 # define YYSTYPE_IS_DECLARED 1
@@ -83,6 +100,8 @@ typedef union YYSTYPE YYSTYPE;
 
 
 
+
 int yyparse (void* scanner, Cmds** cmds, char** err_msg);
 
+
 #endif /* !YY_YY_CMDPARSER_H_INCLUDED  */
@@ -1,6 +1,8 @@
 %{
 #include <err.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 /* Parser must be included before lexel.*/
 #include "cmdparser.h"
@@ -35,21 +37,29 @@ int yyerror(yyscan_t  scanner,Cmds** cmds,char **err_msg, const char *msg);
 
 %token TOK_SCOLON ";"
 %token TOK_IO_IN "<"
+%token TOK_IO_HEREDOC "<<"
+%token TOK_IO_HERESTR "<<<"
 %token TOK_IO_OUT ">"
 %token TOK_IO_APP ">>"
 %token TOK_PIPE "|"
+%token TOK_AND "&&"
+%token TOK_OR "||"
+%token TOK_LPAREN "("
+%token TOK_RPAREN ")"
+%token TOK_LBRACE "{"
+%token TOK_RBRACE "}"
 %token <sval> TOK_STR "string"
 
 %type <io> maybeio
 %type <simple> simplecmd
-%type <cmd> cmd
-%type <cmds> cmds
+%type <cmd> cmd element funcdef
+%type <cmds> cmds funcbody
 %start line
 
 %destructor { free($$); } <sval>
 %destructor { cmd_free_pipe($$); } <cmd>
 %destructor { cmd_free_cmds($$); } <cmds>
-%destructor { free($$.in); free($$.out); } <io>
+%destructor { cmd_free_IO(&$$); } <io>
 %%
 
 line:
@@ -67,18 +77,58 @@ line:
 	}
 	;
 cmds:
-	cmds TOK_SCOLON cmd 
+	cmds TOK_SCOLON element 
 	{
 		STAILQ_INSERT_TAIL($1,$3,tailq);
 		$$=$1;
 	}
-	|cmd 
+	|cmds TOK_AND element 
+	{
+		$3->cond=CMD_AND;
+		STAILQ_INSERT_TAIL($1,$3,tailq);
+		$$=$1;
+	}
+	|cmds TOK_OR element 
+	{
+		$3->cond=CMD_OR;
+		STAILQ_INSERT_TAIL($1,$3,tailq);
+		$$=$1;
+	}
+	|element 
 	{
 		Cmds* cmds=cmd_alloc_cmds();
 		STAILQ_INSERT_TAIL(cmds,$1,tailq);
 		$$=cmds;
 	}
 	;
+element:
+	cmd
+	|funcdef
+	;
+funcdef:
+	maybeio TOK_STR TOK_LPAREN TOK_RPAREN funcbody
+	{
+		if($1.in || $1.out || $1.here || $1.here_end){
+			/* Symbols of this rule are not destroyed by YYABORT. */
+			cmd_free_IO(&$1);
+			free($2);
+			cmd_free_cmds($5);
+			yyerror(scanner,cmds,err_msg,"redirection of a function definition");
+			YYABORT;
+		}
+		$$=cmd_alloc_funcdef($2,$5);
+	}
+	;
+funcbody:
+	TOK_LBRACE cmds TOK_SCOLON TOK_RBRACE
+	{
+		$$=$2;
+	}
+	|TOK_LBRACE cmds TOK_RBRACE
+	{
+		$$=$2;
+	}
+	;
 cmd:
 	cmd TOK_PIPE simplecmd 
 	{
@@ -112,8 +162,24 @@ simplecmd:
 maybeio:
 	maybeio TOK_IO_IN TOK_STR 
 	{
-		free($1.in);
-		$1.in=$3;
+		cmd_set_input(&$1,$3,NULL,NULL);
+		$$=$1;
+	}
+	|maybeio TOK_IO_HEREDOC TOK_STR 	/* body is read after the line */
+	{
+		cmd_set_input(&$1,NULL,$3,NULL);
+		$$=$1;
+	}
+	|maybeio TOK_IO_HERESTR TOK_STR 
+	{
+		/* The string is one line. */
+		size_t len=strlen($3);
+		char* here=realloc($3,len+2);
+		if(!here)
+			err(1,"malloc");
+		here[len]='\n';
+		here[len+1]='\0';
+		cmd_set_input(&$1,NULL,NULL,here);
 		$$=$1;
 	}
 	|maybeio TOK_IO_OUT TOK_STR 
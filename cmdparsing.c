@@ -1,17 +1,61 @@
 #include "cmdparsing.h"
 
 #include <assert.h>
+#include <err.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/queue.h>
 
 /* Parser must be include before lexer. */
 #include "cmdparser.h"
 #include "cmdlexer.h"
+#include "funcs.h"
+#include "optimize.h"
+#include "stats.h"
 
-Cmds *
-parse_line(const char *line, char **err_msg) {
-	assert(line);
-	assert(err_msg);
+/* Lines kept by the cache of parsed lines. */
+#define CACHE_SIZE 256
+/* Buckets of its hash table, a power of two. */
+#define CACHE_BUCKETS 512
+/* Longer lines are not cached. */
+#define CACHE_MAX_LINE 4096
+
+/* One parsed line, its 'cmds' are handed out to the callers. */
+typedef struct parsed_tag {
+	/* NULL if it is not cached. */
+	char *line;
+	uint64_t hash;
+	/* State which optimize_cmds() depended on. */
+	unsigned long funcs_gen;
+	bool optimized;
+	/* Callers which have not released the commands yet. */
+	size_t refs;
+	/* Whether it is in the cache, otherwise the last release frees it. */
+	bool cached;
+	struct parsed_tag *next;
+	TAILQ_ENTRY(parsed_tag) lru;
+	Cmds cmds;
+} parsed;
 
+TAILQ_HEAD(parsed_list, parsed_tag);
+
+static struct {
+	/* Chained hash table keyed by the lines. */
+	parsed *buckets[CACHE_BUCKETS];
+	/* The most recently used first. */
+	struct parsed_list lru;
+	size_t count;
+} cache = {{NULL}, TAILQ_HEAD_INITIALIZER(cache.lru), 0};
+
+/* Parses and rewrites the line like parse_line(), sets *uses_files if the
+ * rewritten commands depend on files and must not be cached.
+ * */
+static Cmds *
+parse(const char *line, char **err_msg, bool *uses_files) {
 	yyscan_t scanner;
 	yylex_init(&scanner);
 	YY_BUFFER_STATE state = yy_scan_string(line, scanner);
@@ -22,6 +66,207 @@ parse_line(const char *line, char **err_msg) {
 	if (parsing_status == 1) {
 		cmd_free_cmds(cmds);
 		return NULL;
-	} else
-		return cmds;
+	}
+	*uses_files = optimize_cmds(cmds);
+	return cmds;
+}
+
+Cmds *
+parse_line(const char *line, char **err_msg) {
+	assert(line);
+	assert(err_msg);
+
+	bool uses_files;
+	return parse(line, err_msg, &uses_files);
+}
+
+/* Reads the body of one here-document into io->here. */
+static bool
+read_heredoc(CmdIO *io, line_source next_line, void *ctx, char **err_msg) {
+	size_t len = 0, cap = 256;
+	char *body = malloc(cap);
+	if (!body)
+		err(1, "malloc");
+	body[0] = '\0';
+	char *line;
+	while ((line = next_line(ctx)) && strcmp(line, io->here_end) != 0) {
+		size_t line_len = strlen(line);
+		if (len + line_len + 2 > cap) {
+			cap = 2 * cap + line_len;
+			if (!(body = realloc(body, cap)))
+				err(1, "malloc");
+		}
+		memcpy(body + len, line, line_len);
+		len += line_len;
+		body[len++] = '\n';
+		body[len] = '\0';
+		free(line);
+	}
+	if (!line) {
+		const char *fmt = "here-document ended by end of input, wanted \"%s\"";
+		size_t msg_len = strlen(fmt) + strlen(io->here_end);
+		if (!(*err_msg = malloc(msg_len)))
+			err(1, "malloc");
+		snprintf(*err_msg, msg_len, fmt, io->here_end);
+		free(body);
+		return false;
+	}
+	free(line);
+	cmd_set_input(io, NULL, NULL, body);
+	return true;
+}
+
+bool
+parse_heredocs(Cmds *cmds, line_source next_line, void *ctx, char **err_msg) {
+	assert(cmds);
+	assert(next_line);
+	assert(err_msg);
+
+	PipeCmd *pipe;
+	CmdSimple *cmd;
+	STAILQ_FOREACH(pipe, cmds, tailq) {
+		/* Here-documents of the body follow in the order of the text. */
+		if (pipe->func &&
+			!parse_heredocs(pipe->func->body, next_line, ctx, err_msg))
+			return false;
+		STAILQ_FOREACH(cmd, &pipe->cmds, tailq) {
+			if (cmd->io.here_end &&
+				!read_heredoc(&cmd->io, next_line, ctx, err_msg))
+				return false;
+		}
+	}
+	return true;
+}
+
+/* FNV-1a hash of the line. */
+static uint64_t
+hash_line(const char *line) {
+	uint64_t hash = 14695981039346656037ull;
+	for (; *line; ++line) {
+		hash ^= (unsigned char)*line;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/* Frees the line with its commands. */
+static void
+parsed_free(parsed *p) {
+	PipeCmd *pipe;
+	while ((pipe = STAILQ_FIRST(&p->cmds))) {
+		STAILQ_REMOVE_HEAD(&p->cmds, tailq);
+		cmd_free_pipe(pipe);
+	}
+	free(p->line);
+	free(p);
+}
+
+/* Removes the line from the cache, it is freed once it is not used. */
+static void
+cache_remove(parsed *p) {
+	parsed **link = &cache.buckets[p->hash & (CACHE_BUCKETS - 1)];
+	while (*link != p)
+		link = &(*link)->next;
+	*link = p->next;
+	TAILQ_REMOVE(&cache.lru, p, lru);
+	--cache.count;
+	p->cached = false;
+	if (p->refs == 0)
+		parsed_free(p);
+}
+
+/* Adds the line to the cache, the least recently used one is evicted if
+ * the cache is full.
+ * */
+static void
+cache_insert(parsed *p) {
+	if (cache.count == CACHE_SIZE)
+		cache_remove(TAILQ_LAST(&cache.lru, parsed_list));
+	parsed **bucket = &cache.buckets[p->hash & (CACHE_BUCKETS - 1)];
+	p->next = *bucket;
+	*bucket = p;
+	TAILQ_INSERT_HEAD(&cache.lru, p, lru);
+	++cache.count;
+	p->cached = true;
+}
+
+static parsed *
+cache_find(const char *line, uint64_t hash) {
+	parsed *p = cache.buckets[hash & (CACHE_BUCKETS - 1)];
+	while (p && (p->hash != hash || strcmp(p->line, line) != 0))
+		p = p->next;
+	return p;
+}
+
+/* Whether 'cmds' have here-documents, also in bodies of functions. */
+static bool
+has_heredocs(const Cmds *cmds) {
+	const PipeCmd *pipe;
+	const CmdSimple *cmd;
+	STAILQ_FOREACH(pipe, cmds, tailq) {
+		if (pipe->func && has_heredocs(pipe->func->body))
+			return true;
+		STAILQ_FOREACH(cmd, &pipe->cmds, tailq) {
+			if (cmd->io.here_end)
+				return true;
+		}
+	}
+	return false;
+}
+
+Cmds *
+parse_line_cached(const char *line, char **err_msg) {
+	assert(line);
+	assert(err_msg);
+
+	uint64_t start = stats_now();
+	bool cacheable = strlen(line) <= CACHE_MAX_LINE;
+	uint64_t hash = hash_line(line);
+	unsigned long funcs_gen = funcs_generation();
+	bool optimized = optimize_enabled();
+	parsed *p = cacheable ? cache_find(line, hash) : NULL;
+	if (p && (p->funcs_gen != funcs_gen || p->optimized != optimized)) {
+		cache_remove(p);
+		p = NULL;
+	}
+	if (p) {
+		TAILQ_REMOVE(&cache.lru, p, lru);
+		TAILQ_INSERT_HEAD(&cache.lru, p, lru);
+		++p->refs;
+		stats_record("parse-cached", stats_now() - start);
+		return &p->cmds;
+	}
+
+	bool uses_files;
+	Cmds *cmds = parse(line, err_msg, &uses_files);
+	if (!cmds)
+		return NULL;
+	if (!(p = malloc(sizeof *p)))
+		err(1, "malloc");
+	p->line = NULL;
+	p->hash = hash;
+	p->funcs_gen = funcs_gen;
+	p->optimized = optimized;
+	p->refs = 1;
+	p->cached = false;
+	STAILQ_INIT(&p->cmds);
+	STAILQ_CONCAT(&p->cmds, cmds);
+	free(cmds);
+	if (cacheable && !uses_files && !has_heredocs(&p->cmds)) {
+		if (!(p->line = strdup(line)))
+			err(1, "malloc");
+		cache_insert(p);
+	}
+	stats_record("parse", stats_now() - start);
+	return &p->cmds;
+}
+
+void
+parse_release(Cmds *cmds) {
+	if (!cmds)
+		return;
+	parsed *p = (parsed *)((char *)cmds - offsetof(parsed, cmds));
+	assert(p->refs > 0);
+	if (--p->refs == 0 && !p->cached)
+		parsed_free(p);
 }
@@ -1,13 +1,46 @@
 #ifndef MYSHELL_CMD_PARSING_HEADER
 #define MYSHELL_CMD_PARSING_HEADER
 
+#include <stdbool.h>
+
 #include "cmdhiearchy.h"
 
-/* Parses passed command line into commands.
- * Returns Commands on success, NULL on syntax error.
+/* Parses passed command line into commands, which are then rewritten by
+ * optimize_cmds(). Returns Commands on success, NULL on syntax error.
  * In that case 'err_msg' is set to an error message which the caller must
  * deallocate. Otherwise its unchanged.
  * */
 Cmds *
 parse_line(const char *line, char **err_msg);
+
+/* Returns commands of 'line' like parse_line(), but recently used lines are
+ * taken from an LRU cache of 256 parsed lines without lexing and parsing
+ * them again. The commands may be shared, so they must not be modified
+ * except by parse_heredocs() and are released by parse_release() instead
+ * of cmd_free_cmds(). Lines with here-documents, whose bodies differ, and
+ * lines over 4 KiB are not cached, nor are lines which optimize_cmds()
+ * rewrote depending on files. Cached lines are parsed again once
+ * MYSH_OPTIMIZE is switched or a function or alias is added or removed,
+ * because optimize_cmds() depends on them. Parse times of both kinds are
+ * recorded for 'stats' as "parse" and "parse-cached".
+ * */
+Cmds *
+parse_line_cached(const char *line, char **err_msg);
+
+/* Releases commands returned by parse_line_cached(). */
+void
+parse_release(Cmds *cmds);
+
+/* Returns the next input line without '\n' which the caller frees, or NULL
+ * at the end of the input. 'ctx' is passed to it.
+ * */
+typedef char *(*line_source)(void *ctx);
+
+/* Reads bodies of the here-documents in 'cmds' from the lines following the
+ * parsed one, in the order of the here-documents.
+ * Returns false if the input ends before a delimiter. In that case
+ * 'err_msg' is set to an error message which the caller must deallocate.
+ * */
+bool
+parse_heredocs(Cmds *cmds, line_source next_line, void *ctx, char **err_msg);
 #endif /* ifndef MYSHELL_CMD_PARSING_HEADER */
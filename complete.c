@@ -0,0 +1,356 @@
+#include "complete.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <readline/readline.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "builtins.h"
+#include "dirlist.h"
+#include "stats.h"
+#include "vars.h"
+
+#define LISTING_CACHE_SIZE 64
+
+/* Directory from $PATH. */
+typedef struct {
+	char *path;
+	/* Inotify watch, -1 if the directory is checked by mtime instead. */
+	int wd;
+	struct timespec mtime;
+	/* Whether the listing might be out of date. */
+	bool dirty;
+	listing list;
+} path_dir;
+
+/* Index of command names. */
+static struct {
+	/* Value of $PATH the index is built for, NULL if not built yet. */
+	char *path_var;
+	path_dir *dirs;
+	size_t num_dirs;
+	/* Inotify instance, -1 if not available. */
+	int inotify_fd;
+	/* Sorted unique command names, they point into the dirs' listings. */
+	char **names;
+	size_t count;
+	/* Whether 'names' must be merged again from the listings. */
+	bool stale;
+} cmd_index = {NULL, NULL, 0, -1, NULL, 0, true};
+
+/* Cached listing of a directory used for filenames. */
+typedef struct {
+	/* NULL for unused entry. */
+	char *path;
+	struct timespec mtime;
+	/* Time of the last use for LRU replacement. */
+	uint64_t used;
+	listing list;
+} listing_entry;
+
+static listing_entry listing_cache[LISTING_CACHE_SIZE];
+
+static int
+cmp_names(const void *l, const void *r) {
+	return strcmp(*(char *const *)l, *(char *const *)r);
+}
+
+/* Whether the modification times are equal. */
+static bool
+same_mtime(const struct timespec *l, const struct timespec *r) {
+	return l->tv_sec == r->tv_sec && l->tv_nsec == r->tv_nsec;
+}
+
+/* Forgets the whole command index. */
+static void
+cmd_index_clear() {
+	for (size_t i = 0; i < cmd_index.num_dirs; ++i) {
+		path_dir *dir = &cmd_index.dirs[i];
+		if (dir->wd != -1)
+			inotify_rm_watch(cmd_index.inotify_fd, dir->wd);
+		free(dir->path);
+		listing_free(&dir->list);
+	}
+	free(cmd_index.dirs);
+	cmd_index.dirs = NULL;
+	cmd_index.num_dirs = 0;
+	free(cmd_index.path_var);
+	cmd_index.path_var = NULL;
+	cmd_index.stale = true;
+}
+
+/* Creates directories of the index from 'path_var'. Their listings are read
+ * later by cmd_index_refresh().
+ * */
+static void
+cmd_index_setup(const char *path_var) {
+	cmd_index_clear();
+	if (!(cmd_index.path_var = strdup(path_var)))
+		err(1, "malloc");
+	if (cmd_index.inotify_fd == -1)
+		cmd_index.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	size_t max_dirs = 1;
+	for (const char *c = path_var; *c; ++c)
+		max_dirs += *c == ':';
+	cmd_index.dirs = calloc(max_dirs, sizeof *cmd_index.dirs);
+	if (!cmd_index.dirs)
+		err(1, "malloc");
+
+	const char *start = path_var;
+	while (true) {
+		size_t len = strcspn(start, ":");
+		/* Empty entry means the current directory, which changes too often
+		 * to be indexed. */
+		if (len > 0) {
+			path_dir *dir = &cmd_index.dirs[cmd_index.num_dirs++];
+			if (!(dir->path = strndup(start, len)))
+				err(1, "malloc");
+			dir->wd = -1;
+			dir->dirty = true;
+			if (cmd_index.inotify_fd != -1)
+				dir->wd = inotify_add_watch(
+					cmd_index.inotify_fd, dir->path,
+					IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+						IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+		}
+		if (start[len] == '\0')
+			break;
+		start += len + 1;
+	}
+}
+
+/* Marks directories reported by inotify as dirty. */
+static void
+cmd_index_read_events() {
+	if (cmd_index.inotify_fd == -1)
+		return;
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(cmd_index.inotify_fd, buf, sizeof buf)) > 0) {
+		for (char *ptr = buf; ptr < buf + len;) {
+			const struct inotify_event *event = (void *)ptr;
+			for (size_t i = 0; i < cmd_index.num_dirs; ++i)
+				if (cmd_index.dirs[i].wd == event->wd)
+					cmd_index.dirs[i].dirty = true;
+			ptr += sizeof *event + event->len;
+		}
+	}
+}
+
+/* Brings the index up to date with $PATH and the directories. */
+static void
+cmd_index_refresh() {
+	const char *path_var = vars_get("PATH");
+	if (!path_var)
+		path_var = "";
+	if (!cmd_index.path_var || strcmp(cmd_index.path_var, path_var) != 0)
+		cmd_index_setup(path_var);
+	cmd_index_read_events();
+
+	for (size_t i = 0; i < cmd_index.num_dirs; ++i) {
+		path_dir *dir = &cmd_index.dirs[i];
+		struct stat st;
+		/* Watched directories are only stat-ed when inotify reports them. */
+		if (dir->wd != -1 && !dir->dirty)
+			continue;
+		if (stat(dir->path, &st) == -1) {
+			cmd_index.stale |= dir->list.count > 0;
+			listing_free(&dir->list);
+			dir->dirty = false;
+			continue;
+		}
+		if (!dir->dirty && same_mtime(&st.st_mtim, &dir->mtime))
+			continue;
+		dir->mtime = st.st_mtim;
+		dir->dirty = false;
+		if (!listing_read(dir->path, &dir->list, true))
+			listing_free(&dir->list);
+		cmd_index.stale = true;
+	}
+	if (!cmd_index.stale)
+		return;
+
+	/* Merge the listings and builtins into one sorted unique array. */
+	size_t total = 0;
+	for (size_t i = 0; i < cmd_index.num_dirs; ++i)
+		total += cmd_index.dirs[i].list.count;
+	for (size_t i = 0; builtin_name(i); ++i)
+		++total;
+	char **names = realloc(cmd_index.names, (total + 1) * sizeof *names);
+	if (!names)
+		err(1, "malloc");
+	size_t count = 0;
+	for (size_t i = 0; i < cmd_index.num_dirs; ++i) {
+		listing *list = &cmd_index.dirs[i].list;
+		memcpy(names + count, list->names, list->count * sizeof *names);
+		count += list->count;
+	}
+	for (size_t i = 0; builtin_name(i); ++i)
+		names[count++] = (char *)builtin_name(i);
+	qsort(names, count, sizeof *names, &cmp_names);
+	size_t unique = 0;
+	for (size_t i = 0; i < count; ++i)
+		if (unique == 0 || strcmp(names[unique - 1], names[i]) != 0)
+			names[unique++] = names[i];
+	cmd_index.names = names;
+	cmd_index.count = unique;
+	cmd_index.stale = false;
+}
+
+/* Returns up-to-date listing of 'path' from the cache. Returns NULL if the
+ * directory cannot be read.
+ * */
+static const listing *
+listing_get(const char *path) {
+	struct stat st;
+	if (stat(path, &st) == -1)
+		return NULL;
+
+	listing_entry *entry = NULL;
+	listing_entry *lru = &listing_cache[0];
+	for (int i = 0; i < LISTING_CACHE_SIZE && !entry; ++i) {
+		if (listing_cache[i].path && strcmp(listing_cache[i].path, path) == 0)
+			entry = &listing_cache[i];
+		else if (listing_cache[i].used < lru->used)
+			lru = &listing_cache[i];
+	}
+	if (entry && same_mtime(&entry->mtime, &st.st_mtim)) {
+		entry->used = stats_now();
+		return &entry->list;
+	}
+	if (!entry) {
+		entry = lru;
+		free(entry->path);
+		listing_free(&entry->list);
+		if (!(entry->path = strdup(path)))
+			err(1, "malloc");
+	}
+	if (!listing_read(path, &entry->list, false)) {
+		free(entry->path);
+		entry->path = NULL;
+		entry->used = 0;
+		return NULL;
+	}
+	entry->mtime = st.st_mtim;
+	entry->used = stats_now();
+	return &entry->list;
+}
+
+/* Current state of the matches generator. */
+static struct {
+	/* Sorted candidates, iterated from 'next' while they match 'prefix'. */
+	char *const *names;
+	size_t count;
+	size_t next;
+	/* Part of the completed word before the matched names. */
+	const char *dir_part;
+	const char *prefix;
+	/* Whether directories get '/' appended. */
+	bool mark_dirs;
+} gen;
+
+/* Generator of the matches for rl_completion_matches. */
+static char *
+generate(const char *text, int state) {
+	(void)text;
+	(void)state;
+	size_t prefix_len = strlen(gen.prefix);
+	while (gen.next < gen.count &&
+		   strncmp(gen.names[gen.next], gen.prefix, prefix_len) == 0) {
+		const char *name = gen.names[gen.next++];
+		/* Hidden files only if asked for. */
+		if (name[0] == '.' && gen.prefix[0] != '.')
+			continue;
+		bool slash = gen.mark_dirs && listing_type(name) == DT_DIR;
+		size_t len = strlen(gen.dir_part) + strlen(name) + 2;
+		char *match = malloc(len);
+		if (!match)
+			err(1, "malloc");
+		snprintf(match, len, "%s%s%s", gen.dir_part, name, slash ? "/" : "");
+		return match;
+	}
+	return NULL;
+}
+
+/* Whether the word starting at 'start' of the line is a command name. */
+static bool
+is_cmd_position(int start) {
+	int i = start - 1;
+	while (i >= 0 && (rl_line_buffer[i] == ' ' || rl_line_buffer[i] == '\t'))
+		--i;
+	return i < 0 || strchr(";|&", rl_line_buffer[i]) != NULL;
+}
+
+/* Completes 'text' which is a part of the line [start,end). */
+static char **
+complete(const char *text, int start, int end) {
+	(void)end;
+	uint64_t begin = stats_now();
+	rl_attempted_completion_over = 1;
+
+	char **matches;
+	if (is_cmd_position(start) && !strchr(text, '/')) {
+		cmd_index_refresh();
+		gen.names = cmd_index.names;
+		gen.count = cmd_index.count;
+		gen.next = listing_lower_bound(gen.names, gen.count, text);
+		gen.dir_part = "";
+		gen.prefix = text;
+		gen.mark_dirs = false;
+		matches = rl_completion_matches(text, &generate);
+	} else {
+		/* Split the word into directory and the name prefix. */
+		const char *slash = strrchr(text, '/');
+		size_t dir_len = slash ? (size_t)(slash - text + 1) : 0;
+		char *dir_part = strndup(text, dir_len);
+		char *path;
+		if (!dir_part)
+			err(1, "malloc");
+		const char *home = vars_get("HOME");
+		if (dir_len == 0)
+			path = strdup(".");
+		else if (strncmp(dir_part, "~/", 2) == 0 && home) {
+			path = malloc(strlen(home) + dir_len);
+			if (path)
+				sprintf(path, "%s%s", home, dir_part + 1);
+		} else
+			path = strdup(dir_part);
+		if (!path)
+			err(1, "malloc");
+
+		const listing *list = listing_get(path);
+		gen.names = list ? list->names : NULL;
+		gen.count = list ? list->count : 0;
+		gen.prefix = text + dir_len;
+		gen.next = listing_lower_bound(gen.names, gen.count, gen.prefix);
+		gen.dir_part = dir_part;
+		gen.mark_dirs = true;
+		matches = rl_completion_matches(text, &generate);
+		free(dir_part);
+		free(path);
+	}
+	/* Unique directory match continues with its contents. */
+	if (matches && !matches[1]) {
+		size_t len = strlen(matches[0]);
+		rl_completion_suppress_append = len > 0 && matches[0][len - 1] == '/';
+	}
+	stats_record("complete", stats_now() - begin);
+	return matches;
+}
+
+void
+complete_init() {
+	rl_attempted_completion_function = &complete;
+}
@@ -0,0 +1,19 @@
+#ifndef MYSHELL_COMPLETE_HEADER
+#define MYSHELL_COMPLETE_HEADER
+
+/* Tab completion of the interactive mode.
+ *
+ * Command names are completed from a sorted index of $PATH directories and
+ * builtins. A directory is listed again only when inotify reports a change
+ * in it or, for directories which cannot be watched, when its mtime
+ * changes. Filenames are completed from cached directory listings which are
+ * validated by mtime. Latency of each completion is recorded into the
+ * "complete" stats tracker.
+ * */
+
+/* Installs the completion into readline. Nothing is read until the first
+ * completion.
+ * */
+void
+complete_init();
+#endif /* ifndef MYSHELL_COMPLETE_HEADER */
@@ -0,0 +1,367 @@
+#define _GNU_SOURCE /* accept4, close_range, MSG_CMSG_CLOEXEC */
+#include "daemon.h"
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "eventloop.h"
+#include "jobs.h"
+#include "run_script.h"
+#include "signals.h"
+#include "vars.h"
+
+/* Number of the passed standard descriptors. */
+#define REQ_FDS 3
+/* Connections waiting to be accepted. */
+#define DAEMON_BACKLOG 64
+
+/* One request, i.e. one connection. */
+typedef struct request {
+	/* -1 once the client hung up. */
+	int conn;
+	/* "commands\0directory\0NAME=value\0..." of 'len' bytes plus a NUL, NULL
+	 * until it arrives.
+	 * */
+	char *msg;
+	size_t len;
+	/* Standard descriptors of the commands, -1 for /dev/null. */
+	int fds[REQ_FDS];
+	/* -1 until it runs. */
+	pid_t worker;
+	bool cancelled;
+	TAILQ_ENTRY(request) tailq;
+} request;
+
+TAILQ_HEAD(request_list, request);
+
+static struct {
+	int listen_fd;
+	const char *path;
+	int max_workers;
+	int num_workers;
+	/* All requests in the order of their connections. */
+	struct request_list requests;
+	/* SIGINT arrived, no new requests are accepted. */
+	bool stopping;
+} server = {-1, NULL, 0, 0, TAILQ_HEAD_INITIALIZER(server.requests), false};
+
+/* Closes the request's connection and descriptors and frees it. */
+static void
+request_free(request *req) {
+	if (req->conn != -1) {
+		ev_unwatch(req->conn);
+		close(req->conn);
+	}
+	for (int i = 0; i < REQ_FDS; ++i)
+		if (req->fds[i] != -1)
+			close(req->fds[i]);
+	free(req->msg);
+	TAILQ_REMOVE(&server.requests, req, tailq);
+	free(req);
+}
+
+/* Sends 'exval' to the client, if it still listens, and frees the request. */
+static void
+request_finish(request *req, int exval) {
+	if (req->conn != -1) {
+		char buf[16];
+		int len = snprintf(buf, sizeof buf, "%d", exval);
+		/* The client may have gone meanwhile, it need not be told. */
+		send(req->conn, buf, len, MSG_NOSIGNAL);
+	}
+	request_free(req);
+}
+
+/* Replaces the worker's standard descriptors with the request's ones and
+ * closes all others except for the signalfd.
+ * */
+static void
+worker_set_fds(request *req) {
+	/* A daemon started with closed standard descriptors may have got them
+	 * among the ones to be replaced.
+	 * */
+	sig_move_fd(REQ_FDS);
+	for (int i = 0; i < REQ_FDS; ++i)
+		if (req->fds[i] != -1 && req->fds[i] < REQ_FDS &&
+			(req->fds[i] = fcntl(req->fds[i], F_DUPFD_CLOEXEC, REQ_FDS)) == -1)
+			err(1, "fcntl");
+	for (int i = 0; i < REQ_FDS; ++i) {
+		int fd = req->fds[i];
+		int flags = (i == 0 ? O_RDONLY : O_WRONLY) | O_CLOEXEC;
+		if (fd == -1 && (fd = open("/dev/null", flags)) == -1)
+			err(1, "/dev/null");
+		if (dup2(fd, i) == -1)
+			err(1, "dup2");
+	}
+	unsigned int keep = sig_fd();
+	if ((keep > REQ_FDS && close_range(REQ_FDS, keep - 1, 0) == -1) ||
+		close_range(keep + 1, ~0u, 0) == -1)
+		err(1, "close_range");
+}
+
+/* Runs the request in the forked worker, never returns. */
+static void
+worker_run(request *req) {
+	/* Away from the daemon's C-c, cancelling reaches just this worker. */
+	setpgid(0, 0);
+	worker_set_fds(req);
+	const char *cmds = req->msg;
+	const char *end = req->msg + req->len;
+	const char *dir = cmds + strlen(cmds) + 1;
+	size_t num_env = 0;
+	for (const char *e = dir; e < end; e += strlen(e) + 1)
+		++num_env;
+	char **envp = malloc((num_env + 1) * sizeof *envp);
+	if (!envp)
+		err(1, "malloc");
+	num_env = 0;
+	/* The directory itself is skipped. */
+	for (const char *e = dir; e < end; e += strlen(e) + 1)
+		if (e != dir)
+			envp[num_env++] = (char *)e;
+	envp[num_env] = NULL;
+	vars_clear();
+	vars_init(envp);
+	free(envp);
+	if (dir < end && *dir && chdir(dir) == -1)
+		err(1, "%s", dir);
+	jobs_exit_on_interrupt();
+	exit(run_string(cmds));
+}
+
+/* Starts workers of the queued requests while the limit allows it. */
+static void
+start_workers() {
+	request *req;
+	TAILQ_FOREACH(req, &server.requests, tailq) {
+		if (server.num_workers >= server.max_workers)
+			break;
+		if (!req->msg || req->worker != -1)
+			continue;
+		switch (req->worker = fork()) {
+		case -1:
+			err(1, "fork");
+		case 0: /* Child */
+			worker_run(req);
+			break;
+		default:
+			++server.num_workers;
+			break;
+		}
+		/* The worker has its own copies. */
+		for (int i = 0; i < REQ_FDS; ++i)
+			if (req->fds[i] != -1) {
+				close(req->fds[i]);
+				req->fds[i] = -1;
+			}
+	}
+}
+
+/* Cancels the request, see daemon.h. */
+static void
+request_cancel(request *req) {
+	if (req->worker != -1) {
+		if (!req->cancelled)
+			kill(req->worker, SIGINT);
+		req->cancelled = true;
+	} else if (req->msg)
+		request_finish(req, 128 + SIGINT);
+	else
+		request_free(req);
+}
+
+/* Receives the request's message with the descriptors. Returns 1 once it
+ * arrived, 0 if it has not yet and -1 if it is invalid or the client hung
+ * up.
+ * */
+static int
+request_receive(request *req) {
+	ssize_t len = recv(req->conn, NULL, 0, MSG_PEEK | MSG_TRUNC);
+	if (len == -1 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (len <= 0)
+		return -1;
+	if (!(req->msg = malloc(len + 1)))
+		err(1, "malloc");
+	char control[CMSG_SPACE(REQ_FDS * sizeof(int))];
+	struct iovec iov = {req->msg, len};
+	struct msghdr hdr = {.msg_iov = &iov,
+						 .msg_iovlen = 1,
+						 .msg_control = control,
+						 .msg_controllen = sizeof control};
+	ssize_t got = recvmsg(req->conn, &hdr, MSG_CMSG_CLOEXEC);
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(&hdr); got > 0 && c;
+		 c = CMSG_NXTHDR(&hdr, c))
+		if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+			size_t num = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(req->fds, CMSG_DATA(c), num * sizeof(int));
+		}
+	if (got <= 0 || (hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+		!memchr(req->msg, '\0', got))
+		return -1;
+	req->len = got;
+	req->msg[got] = '\0';
+	return 1;
+}
+
+/* Receives the request or its cancellation. */
+static void
+on_conn(void *ctx) {
+	request *req = ctx;
+	if (!req->msg) {
+		int res = request_receive(req);
+		if (res == -1)
+			request_free(req);
+		else if (res == 1)
+			start_workers();
+		return;
+	}
+	char byte;
+	ssize_t len = recv(req->conn, &byte, sizeof byte, 0);
+	if (len == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (len <= 0) {
+		ev_unwatch(req->conn);
+		close(req->conn);
+		req->conn = -1;
+	}
+	request_cancel(req);
+}
+
+static void
+on_accept(void *ctx) {
+	(void)ctx;
+	int conn;
+	while ((conn = accept4(server.listen_fd, NULL, NULL,
+						   SOCK_CLOEXEC | SOCK_NONBLOCK)) != -1) {
+		request *req = malloc(sizeof *req);
+		if (!req)
+			err(1, "malloc");
+		*req = (request){conn, NULL, 0, {-1, -1, -1}, -1, false, {0}};
+		TAILQ_INSERT_TAIL(&server.requests, req, tailq);
+		ev_watch(conn, false, &on_conn, req);
+	}
+	if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+		warn("accept");
+}
+
+/* Collects the finished workers and answers their requests. */
+static void
+reap_workers() {
+	request *next;
+	for (request *req = TAILQ_FIRST(&server.requests); req; req = next) {
+		next = TAILQ_NEXT(req, tailq);
+		if (req->worker == -1)
+			continue;
+		int status;
+		pid_t res;
+		while ((res = waitpid(req->worker, &status, WNOHANG)) == -1 &&
+			   errno == EINTR)
+			;
+		if (res == 0)
+			continue;
+		--server.num_workers;
+		if (res == -1)
+			request_finish(req, 1);
+		else
+			request_finish(req, WIFEXITED(status) ? WEXITSTATUS(status)
+												  : 128 + WTERMSIG(status));
+	}
+}
+
+/* Stops accepting requests and cancels all of them, workers which ignore
+ * the cancellation are killed by the next SIGINT.
+ * */
+static void
+stop() {
+	if (!server.stopping) {
+		server.stopping = true;
+		ev_unwatch(server.listen_fd);
+		close(server.listen_fd);
+		unlink(server.path);
+	}
+	request *next;
+	for (request *req = TAILQ_FIRST(&server.requests); req; req = next) {
+		next = TAILQ_NEXT(req, tailq);
+		if (req->cancelled)
+			killpg(req->worker, SIGKILL);
+		else
+			request_cancel(req);
+	}
+}
+
+static void
+on_signal(void *ctx) {
+	(void)ctx;
+	int got = sig_read();
+	if (got & SIG_CHILD) {
+		reap_workers();
+		if (!server.stopping)
+			start_workers();
+	}
+	if (got & SIG_INTERRUPT)
+		stop();
+}
+
+/* Whether nobody listens on the socket at 'addr' any more. */
+static bool
+socket_stale(const struct sockaddr_un *addr) {
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		err(1, "socket");
+	const struct sockaddr *sa = (const struct sockaddr *)addr;
+	bool stale = connect(fd, sa, sizeof *addr) == -1 && errno == ECONNREFUSED;
+	close(fd);
+	return stale;
+}
+
+int
+run_daemon(const char *path, int max_workers) {
+	assert(path);
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof addr.sun_path)
+		errx(1, "%s: socket path too long.", path);
+	strcpy(addr.sun_path, path);
+	server.path = path;
+	server.max_workers = max_workers > 0 ? max_workers
+										 : sysconf(_SC_NPROCESSORS_ONLN);
+	server.listen_fd =
+		socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (server.listen_fd == -1)
+		err(1, "socket");
+	/* Only the owner may connect. */
+	mode_t mask = umask(077);
+	const struct sockaddr *sa = (const struct sockaddr *)&addr;
+	int res = bind(server.listen_fd, sa, sizeof addr);
+	/* Left behind by a daemon which did not stop cleanly. */
+	if (res == -1 && errno == EADDRINUSE && socket_stale(&addr) &&
+		unlink(path) == 0)
+		res = bind(server.listen_fd, sa, sizeof addr);
+	umask(mask);
+	if (res == -1 || listen(server.listen_fd, DAEMON_BACKLOG) == -1)
+		err(1, "Cannot listen on %s.", path);
+	/* Daemons started in the background of a script inherit ignored SIGINT,
+	 * it would neither stop the daemon nor cancel the commands.
+	 * */
+	signal(SIGINT, SIG_DFL);
+	ev_watch(server.listen_fd, false, &on_accept, NULL);
+	ev_watch(sig_fd(), false, &on_signal, NULL);
+	while (!server.stopping || !TAILQ_EMPTY(&server.requests))
+		ev_run_once();
+	return 0;
+}
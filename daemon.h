@@ -0,0 +1,27 @@
+#ifndef MYSHELL_DAEMON_HEADER
+#define MYSHELL_DAEMON_HEADER
+
+/* Command execution daemon.
+ *
+ * The daemon listens on a Unix socket of SOCK_SEQPACKET type, each
+ * connection carries one request. The request is one message with
+ * NUL-separated commands, working directory (empty for the daemon's one) and
+ * "NAME=value" entries of the environment. Standard input, output and error
+ * of the commands are passed along with it by SCM_RIGHTS, missing ones are
+ * /dev/null. The commands run in a worker forked from the daemon, which is
+ * initialized already, so a request costs one fork() instead of starting
+ * a new shell. Once the worker ends, its exit value is sent back as one
+ * message with the decimal number and the connection is closed.
+ *
+ * Any further message or closing the connection cancels the request.
+ * A queued request ends with 130 right away, a running worker is
+ * interrupted like by C-c and exits with 130 once its foreground job ends.
+ * */
+
+/* Serves requests on the socket at 'path' until SIGINT, at most
+ * 'max_workers' run at once, others wait in a queue. 0 means the number of
+ * processors. Only the owner may connect. Exits on error.
+ * */
+int
+run_daemon(const char *path, int max_workers);
+#endif /* ifndef MYSHELL_DAEMON_HEADER */
@@ -0,0 +1,122 @@
+#define _GNU_SOURCE /* getdents64 */
+#include "dirlist.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Size of one getdents64 batch. */
+#define LISTING_BUF_SIZE (1 << 20)
+
+static int
+cmp_names(const void *l, const void *r) {
+	return strcmp(*(char *const *)l, *(char *const *)r);
+}
+
+bool
+listing_read(const char *path, listing *list, bool only_files) {
+	assert(path);
+	assert(list);
+
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+	/* Shared by all reads, it is only needed during one. */
+	static char *buf = NULL;
+	if (!buf && !(buf = malloc(LISTING_BUF_SIZE)))
+		err(1, "malloc");
+	size_t arena_len = 0, arena_cap = 4096;
+	size_t count = 0, cap = 64;
+	char *arena = malloc(arena_cap);
+	size_t *offs = malloc(cap * sizeof *offs);
+	if (!arena || !offs)
+		err(1, "malloc");
+
+	ssize_t read_len;
+	while ((read_len = getdents64(fd, buf, LISTING_BUF_SIZE)) > 0) {
+		for (ssize_t pos = 0; pos < read_len;) {
+			const struct dirent64 *entry = (struct dirent64 *)(buf + pos);
+			pos += entry->d_reclen;
+			const char *name = entry->d_name;
+			if (name[0] == '.' &&
+				(name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+				continue;
+			/* Unknown types are not resolved by stat to keep the listing
+			 * cheap on slow file systems. */
+			if (entry->d_type == DT_DIR && only_files)
+				continue;
+			size_t len = strlen(name) + 1;
+			if (arena_len + len + 1 > arena_cap) {
+				arena_cap = 2 * arena_cap + len;
+				if (!(arena = realloc(arena, arena_cap)))
+					err(1, "malloc");
+			}
+			if (count == cap) {
+				cap *= 2;
+				if (!(offs = realloc(offs, cap * sizeof *offs)))
+					err(1, "malloc");
+			}
+			arena[arena_len++] = entry->d_type;
+			memcpy(arena + arena_len, name, len);
+			offs[count++] = arena_len;
+			arena_len += len;
+		}
+	}
+	int saved_errno = errno;
+	close(fd);
+	if (read_len == -1) {
+		free(arena);
+		free(offs);
+		errno = saved_errno;
+		return false;
+	}
+
+	/* The arena is complete, so the pointers will not move anymore. */
+	char **names = malloc((count + 1) * sizeof *names);
+	if (!names)
+		err(1, "malloc");
+	for (size_t i = 0; i < count; ++i)
+		names[i] = arena + offs[i];
+	free(offs);
+	qsort(names, count, sizeof *names, &cmp_names);
+
+	listing_free(list);
+	list->arena = arena;
+	list->names = names;
+	list->count = count;
+	return true;
+}
+
+void
+listing_free(listing *list) {
+	assert(list);
+
+	free(list->arena);
+	free(list->names);
+	list->arena = NULL;
+	list->names = NULL;
+	list->count = 0;
+}
+
+unsigned char
+listing_type(const char *name) {
+	return name[-1];
+}
+
+size_t
+listing_lower_bound(char *const *names, size_t count, const char *prefix) {
+	size_t lo = 0, hi = count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (strcmp(names[mid], prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
@@ -0,0 +1,40 @@
+#ifndef MYSHELL_DIRLIST_HEADER
+#define MYSHELL_DIRLIST_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Sorted names of entries in one directory, "." and ".." excluded.
+ *
+ * The directory is read with large getdents64 batches instead of readdir's
+ * small ones, which matters for directories with millions of entries.
+ * */
+typedef struct {
+	/* Names, each null-terminated and preceded by its d_type byte. */
+	char *arena;
+	/* Sorted names pointing into the arena. */
+	char **names;
+	size_t count;
+} listing;
+
+/* Reads sorted listing of 'path' into 'list', hidden entries are included.
+ * 'only_files' skips the directories. Returns false if the directory
+ * cannot be read, 'list' is unchanged in that case.
+ * */
+bool
+listing_read(const char *path, listing *list, bool only_files);
+
+/* Frees the listing and leaves it empty. */
+void
+listing_free(listing *list);
+
+/* Returns d_type of the listed name, DT_UNKNOWN if the file system does not
+ * report it.
+ * */
+unsigned char
+listing_type(const char *name);
+
+/* Returns index of the first name not less than 'prefix'. */
+size_t
+listing_lower_bound(char *const *names, size_t count, const char *prefix);
+#endif /* ifndef MYSHELL_DIRLIST_HEADER */
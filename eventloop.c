@@ -0,0 +1,133 @@
+#include "eventloop.h"
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+/* Maximum number of events handled by one ev_run_once(). */
+#define EV_BATCH 16
+
+/* Handler of one descriptor, 'fn' is NULL if it is not watched. */
+typedef struct {
+	ev_handler fn;
+	void *ctx;
+	bool urgent;
+	/* Timer's expirations are consumed before calling the handler. */
+	bool timer;
+} watcher;
+
+static struct {
+	int epfd;
+	/* Indexed by the descriptor. */
+	watcher *watchers;
+	size_t cap;
+} loop = {-1, NULL, 0};
+
+/* Creates the epoll instance on first use. */
+static void
+ev_init() {
+	if (loop.epfd == -1 && (loop.epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		err(1, "Cannot create event loop.(epoll_create1)");
+}
+
+/* Returns the watcher slot for 'fd', the array grows as needed. */
+static watcher *
+ev_slot(int fd) {
+	assert(fd >= 0);
+
+	if ((size_t)fd >= loop.cap) {
+		size_t cap = loop.cap ? loop.cap : 16;
+		while (cap <= (size_t)fd)
+			cap *= 2;
+		watcher *watchers = realloc(loop.watchers, cap * sizeof *watchers);
+		if (!watchers)
+			err(1, "malloc");
+		memset(watchers + loop.cap, 0, (cap - loop.cap) * sizeof *watchers);
+		loop.watchers = watchers;
+		loop.cap = cap;
+	}
+	return &loop.watchers[fd];
+}
+
+void
+ev_watch(int fd, bool urgent, ev_handler fn, void *ctx) {
+	assert(fn);
+
+	ev_init();
+	struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+	/* The descriptor might still be registered from an earlier call, or
+	 * dropped by epoll when its previous file was closed.
+	 * */
+	if (epoll_ctl(loop.epfd, EPOLL_CTL_ADD, fd, &ev) == -1 && errno != EEXIST)
+		err(1, "Cannot watch a descriptor.(epoll_ctl)");
+	*ev_slot(fd) = (watcher){fn, ctx, urgent, false};
+}
+
+void
+ev_unwatch(int fd) {
+	if (loop.epfd == -1 || (size_t)fd >= loop.cap)
+		return;
+	/* Already closed descriptors are gone from epoll. */
+	if (epoll_ctl(loop.epfd, EPOLL_CTL_DEL, fd, NULL) == -1 &&
+		errno != EBADF && errno != ENOENT)
+		err(1, "Cannot unwatch a descriptor.(epoll_ctl)");
+	loop.watchers[fd].fn = NULL;
+}
+
+int
+ev_timer(unsigned int interval_ms, ev_handler fn, void *ctx) {
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd == -1)
+		err(1, "Cannot create a timer.(timerfd_create)");
+	struct timespec interval = {interval_ms / 1000,
+								(interval_ms % 1000) * 1000000L};
+	struct itimerspec spec = {interval, interval};
+	if (timerfd_settime(fd, 0, &spec, NULL) == -1)
+		err(1, "Cannot start a timer.(timerfd_settime)");
+	ev_watch(fd, false, fn, ctx);
+	loop.watchers[fd].timer = true;
+	return fd;
+}
+
+/* Runs the handler of a ready descriptor, if it is still watched. */
+static void
+ev_dispatch(int fd) {
+	if ((size_t)fd >= loop.cap || !loop.watchers[fd].fn)
+		return;
+	watcher *w = &loop.watchers[fd];
+	if (w->timer) {
+		uint64_t expirations;
+		if (read(fd, &expirations, sizeof expirations) == -1)
+			return; /* EAGAIN, nothing has expired after all. */
+	}
+	w->fn(w->ctx);
+}
+
+void
+ev_run_once() {
+	ev_init();
+	struct epoll_event events[EV_BATCH];
+	int count;
+	while ((count = epoll_wait(loop.epfd, events, EV_BATCH, -1)) == -1 &&
+		   errno == EINTR)
+		;
+	if (count == -1)
+		err(1, "Cannot wait for events.(epoll_wait)");
+	for (int i = 0; i < count; ++i) {
+		int fd = events[i].data.fd;
+		if ((size_t)fd < loop.cap && loop.watchers[fd].urgent)
+			ev_dispatch(fd);
+	}
+	for (int i = 0; i < count; ++i) {
+		int fd = events[i].data.fd;
+		if ((size_t)fd < loop.cap && !loop.watchers[fd].urgent)
+			ev_dispatch(fd);
+	}
+}
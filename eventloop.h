@@ -0,0 +1,40 @@
+#ifndef MYSHELL_EVENTLOOP_HEADER
+#define MYSHELL_EVENTLOOP_HEADER
+
+#include <stdbool.h>
+
+/* Event loop of the interactive mode.
+ *
+ * Watched descriptors share one epoll instance and their handlers run in the
+ * shell's only thread, one after another. Urgent handlers, i.e. the terminal
+ * input, run before all others which became ready at the same time, so
+ * background work cannot delay a keystroke waiting in the same batch.
+ * Handlers must not block.
+ * */
+
+typedef void (*ev_handler)(void *ctx);
+
+/* Calls 'fn' with 'ctx' whenever 'fd' is readable or hung up. Watching an
+ * already watched descriptor only updates its handler. Closing the
+ * descriptor stops watching it. Exits on error.
+ * */
+void
+ev_watch(int fd, bool urgent, ev_handler fn, void *ctx);
+
+/* Stops watching 'fd'. */
+void
+ev_unwatch(int fd);
+
+/* Starts a timer calling 'fn' with 'ctx' every 'interval_ms' milliseconds.
+ * Returns its descriptor which can be passed to ev_unwatch() and closed.
+ * Exits on error.
+ * */
+int
+ev_timer(unsigned int interval_ms, ev_handler fn, void *ctx);
+
+/* Waits for at least one event and runs the handlers of all ready
+ * descriptors. Exits on error.
+ * */
+void
+ev_run_once();
+#endif /* ifndef MYSHELL_EVENTLOOP_HEADER */
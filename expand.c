@@ -0,0 +1,352 @@
+#include "expand.h"
+
+#include <assert.h>
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/queue.h>
+
+#include "arith.h"
+#include "cmdexecution.h"
+#include "vars.h"
+
+/* Growable string. */
+typedef struct {
+	char *str;
+	size_t len;
+	size_t cap;
+} str_buf;
+
+static void
+buf_append(str_buf *buf, const char *str, size_t len) {
+	if (buf->len + len + 1 > buf->cap) {
+		buf->cap = 2 * buf->cap + len + 1;
+		if (!(buf->str = realloc(buf->str, buf->cap)))
+			err(1, "malloc");
+	}
+	memcpy(buf->str + buf->len, str, len);
+	buf->len += len;
+	buf->str[buf->len] = '\0';
+}
+
+/* Returns length of the variable name at the start of 'str'. */
+static size_t
+name_len(const char *str) {
+	size_t len = 0;
+	while (vars_valid_name(str, len + 1))
+		++len;
+	return len;
+}
+
+/* Appends value of the variable 'name' of length 'len' to 'buf'. */
+static void
+append_var(str_buf *buf, const char *name, size_t len) {
+	char *copy = strndup(name, len);
+	if (!copy)
+		err(1, "malloc");
+	const char *val = vars_get(copy);
+	if (val)
+		buf_append(buf, val, strlen(val));
+	free(copy);
+}
+
+/* Appends the i-th positional parameter to 'buf', nothing if it is not set.
+ * */
+static void
+append_arg(str_buf *buf, size_t i) {
+	size_t count;
+	char *const *args = vars_args(&count);
+	if (i >= 1 && i <= count)
+		buf_append(buf, args[i - 1], strlen(args[i - 1]));
+}
+
+/* Appends all positional parameters separated by spaces to 'buf'. */
+static void
+append_all_args(str_buf *buf) {
+	size_t count;
+	char *const *args = vars_args(&count);
+	for (size_t i = 0; i < count; ++i) {
+		if (i > 0)
+			buf_append(buf, " ", 1);
+		buf_append(buf, args[i], strlen(args[i]));
+	}
+}
+
+/* Whether 'str' of length 'len' is a positional parameter's number. */
+static bool
+is_arg_number(const char *str, size_t len) {
+	if (len == 0)
+		return false;
+	for (size_t i = 0; i < len; ++i)
+		if (str[i] < '0' || str[i] > '9')
+			return false;
+	return true;
+}
+
+/* Returns the ')' matching '(' at 'open', NULL if there is none. */
+static const char *
+paren_end(const char *open) {
+	assert(*open == '(');
+
+	int depth = 0;
+	for (const char *p = open; *p; ++p)
+		if (*p == '(')
+			++depth;
+		else if (*p == ')' && --depth == 0)
+			return p;
+	return NULL;
+}
+
+/* Returns the first '$' in 'str' or also '<(' or '>(' if 'procsubs' is set,
+ * NULL if there is none.
+ * */
+static const char *
+next_special(const char *str, bool procsubs) {
+	for (const char *p = str; *p; ++p)
+		if (*p == '$' || (procsubs && (*p == '<' || *p == '>') && p[1] == '('))
+			return p;
+	return NULL;
+}
+
+/* Starts process substitution '<(cmds)' or '>(cmds)' at 'open' and appends
+ * its path to 'buf'. Its descriptor is added to 'exp'. 'exval' is "$?" of
+ * the commands.
+ * */
+static void
+start_procsub(str_buf *buf, const char *open, const char *close, int exval,
+			  CmdExpanded *exp) {
+	char *inner = strndup(open + 2, close - open - 2);
+	if (!inner)
+		err(1, "malloc");
+	ProcSub sub;
+	sub.fd = exec_procsub(inner, *open == '>', exval, &sub.pid);
+	free(inner);
+	exp->procsubs =
+		realloc(exp->procsubs, (exp->num_procsubs + 1) * sizeof *exp->procsubs);
+	if (!exp->procsubs)
+		err(1, "malloc");
+	exp->procsubs[exp->num_procsubs++] = sub;
+	char path[32];
+	int len = snprintf(path, sizeof path, "/dev/fd/%d", sub.fd);
+	buf_append(buf, path, len);
+}
+
+/* Returns newly allocated 'word' with the variables and command
+ * substitutions replaced, the exit value of the last substitution is stored
+ * into 'exp'. Process substitutions of 'exp' are started and replaced too if
+ * 'procsubs' is true. A failed arithmetic expansion sets *ok to false and
+ * the rest of the word is left as it is.
+ * */
+static char *
+expand_vars(const char *word, int exval, CmdExpanded *exp, bool procsubs,
+			bool *ok) {
+	str_buf buf = {NULL, 0, 0};
+	buf_append(&buf, "", 0);
+	const char *p = word;
+	const char *dollar;
+	while (*ok && (dollar = next_special(p, procsubs))) {
+		buf_append(&buf, p, dollar - p);
+		if (*dollar != '$') {
+			const char *close = paren_end(dollar + 1);
+			if (close) {
+				start_procsub(&buf, dollar, close, exval, exp);
+				p = close + 1;
+			} else {
+				buf_append(&buf, dollar, 1);
+				p = dollar + 1;
+			}
+			continue;
+		}
+		p = dollar + 1;
+		size_t len;
+		const char *close;
+		if (*p == '?' || *p == '#') {
+			size_t count;
+			vars_args(&count);
+			char status[24];
+			int status_len = *p == '?'
+								 ? snprintf(status, sizeof status, "%d", exval)
+								 : snprintf(status, sizeof status, "%zu", count);
+			buf_append(&buf, status, status_len);
+			++p;
+		} else if (*p >= '1' && *p <= '9') {
+			append_arg(&buf, *p - '0');
+			++p;
+		} else if (*p == '@' || *p == '*') {
+			append_all_args(&buf);
+			++p;
+		} else if (*p == '(' && p[1] == '(' && (close = paren_end(p)) &&
+				   paren_end(p + 1) == close - 1) {
+			/* "$((expr))", not "$((cmds) ...)". */
+			char *inner = strndup(p + 2, close - p - 3);
+			if (!inner)
+				err(1, "malloc");
+			int64_t val;
+			if (arith_eval(inner, &val)) {
+				char num[24];
+				int num_len = snprintf(num, sizeof num, "%lld", (long long)val);
+				buf_append(&buf, num, num_len);
+			} else
+				*ok = false;
+			free(inner);
+			p = close + 1;
+		} else if (*p == '(' && (close = paren_end(p))) {
+			char *inner = strndup(p + 1, close - p - 1);
+			if (!inner)
+				err(1, "malloc");
+			char *output = exec_capture(inner, exval, &exp->subst_exval);
+			buf_append(&buf, output, strlen(output));
+			free(output);
+			free(inner);
+			p = close + 1;
+		} else if (*p == '{' && (close = strchr(p, '}')) &&
+				   vars_valid_name(p + 1, close - p - 1)) {
+			append_var(&buf, p + 1, close - p - 1);
+			p = close + 1;
+		} else if (*p == '{' && (close = strchr(p, '}')) &&
+				   is_arg_number(p + 1, close - p - 1)) {
+			append_arg(&buf, strtoul(p + 1, NULL, 10));
+			p = close + 1;
+		} else if ((len = name_len(p)) > 0) {
+			append_var(&buf, p, len);
+			p += len;
+		} else
+			/* Not a variable, the '$' stays. */
+			buf_append(&buf, "$", 1);
+	}
+	buf_append(&buf, p, strlen(p));
+	return buf.str;
+}
+
+/* Returns newly allocated expansion of 'str' or NULL if 'str' is NULL. */
+static char *
+expand_optional(const char *str, int exval, CmdExpanded *exp, bool procsubs,
+				bool *ok) {
+	return str ? expand_vars(str, exval, exp, procsubs, ok) : NULL;
+}
+
+/* Appends 'field' to 'argv', patterns are expanded. 'field' is claimed. */
+static void
+push_field(char *field, ArgVec *argv) {
+	if (glob_has_magic(field)) {
+		glob_expand(field, argv);
+		free(field);
+	} else
+		argvec_push(argv, field);
+}
+
+/* Whether 'word' stays itself after expansion. */
+static bool
+is_plain(const char *word) {
+	return !next_special(word, true) && !glob_has_magic(word);
+}
+
+/* Appends expansion of one word to 'argv'. Sets *ok like expand_vars(). */
+static void
+expand_word(const char *word, int exval, CmdExpanded *exp, bool *ok) {
+	ArgVec *argv = &exp->argv;
+	if (strcmp(word, "$@") == 0 || strcmp(word, "$*") == 0) {
+		/* Each positional parameter stays one word, as it was passed. */
+		size_t count;
+		char *const *args = vars_args(&count);
+		for (size_t i = 0; i < count; ++i) {
+			char *copy = strdup(args[i]);
+			if (!copy)
+				err(1, "malloc");
+			argvec_push(argv, copy);
+		}
+		return;
+	}
+	bool has_vars = next_special(word, true) != NULL;
+	char *expanded =
+		has_vars ? expand_vars(word, exval, exp, true, ok) : strdup(word);
+	if (!expanded)
+		err(1, "malloc");
+	if (strstr(word, "$(")) {
+		/* Output of the commands is split into words at whitespace. */
+		char *save;
+		for (char *field = strtok_r(expanded, " \t\n", &save); field;
+			 field = strtok_r(NULL, " \t\n", &save)) {
+			char *copy = strdup(field);
+			if (!copy)
+				err(1, "malloc");
+			push_field(copy, argv);
+		}
+		free(expanded);
+	}
+	/* Words consisting of unset variables disappear. */
+	else if (has_vars && expanded[0] == '\0')
+		free(expanded);
+	else
+		push_field(expanded, argv);
+}
+
+bool
+expand_cmd(const CmdSimple *cmd, int exval, CmdExpanded *out) {
+	assert(cmd);
+	assert(out);
+
+	assert(!cmd->io.here_end);
+
+	out->assigns = (ArgVec){NULL, 0, 0};
+	out->argv = (ArgVec){NULL, 0, 0};
+	out->num_plain = 0;
+	out->num_plain_tail = 0;
+	out->subst_exval = -1;
+	out->io = cmd_gen_IO();
+	out->procsubs = NULL;
+	out->num_procsubs = 0;
+	bool ok = true;
+	out->io.in = expand_optional(cmd->io.in, exval, out, true, &ok);
+	out->io.out = expand_optional(cmd->io.out, exval, out, true, &ok);
+	out->io.app = cmd->io.app;
+	out->io.here = expand_optional(cmd->io.here, exval, out, false, &ok);
+	/* The name is the first word, followed by the arguments. */
+	const char *word = cmd->name;
+	CmdArg *arg = STAILQ_FIRST(&cmd->args);
+	while (ok && word && vars_is_assign(word)) {
+		argvec_push(&out->assigns, expand_vars(word, exval, out, false, &ok));
+		word = arg ? arg->val : NULL;
+		arg = arg ? STAILQ_NEXT(arg, tailq) : NULL;
+	}
+	bool plain = true;
+	for (; ok && word; word = arg ? arg->val : NULL,
+					   arg = arg ? STAILQ_NEXT(arg, tailq) : NULL) {
+		size_t count = out->argv.count;
+		expand_word(word, exval, out, &ok);
+		if ((plain = plain && is_plain(word)))
+			out->num_plain = out->argv.count;
+		else if (is_plain(word))
+			out->num_plain_tail += out->argv.count - count;
+		else
+			out->num_plain_tail = 0;
+	}
+	return ok;
+}
+
+void
+expand_close_procsubs(CmdExpanded *exp) {
+	assert(exp);
+
+	for (size_t i = 0; i < exp->num_procsubs; ++i)
+		if (exp->procsubs[i].fd != -1) {
+			close(exp->procsubs[i].fd);
+			exp->procsubs[i].fd = -1;
+		}
+}
+
+void
+expand_free(CmdExpanded *exp) {
+	assert(exp);
+
+	argvec_free(&exp->assigns);
+	argvec_free(&exp->argv);
+	cmd_free_IO(&exp->io);
+	expand_close_procsubs(exp);
+	/* The children are reaped with the job. */
+	free(exp->procsubs);
+}
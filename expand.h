@@ -0,0 +1,73 @@
+#ifndef MYSHELL_EXPAND_HEADER
+#define MYSHELL_EXPAND_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+
+#include "cmdhiearchy.h"
+#include "globbing.h"
+
+/* Running process substitution. */
+typedef struct {
+	/* The shell's end of the pipe, -1 once closed. */
+	int fd;
+	pid_t pid;
+} ProcSub;
+
+/* Words of a command after expansion. */
+typedef struct {
+	/* Leading "NAME=value" assignments. */
+	ArgVec assigns;
+	/* Name and arguments, empty if the command only assigns variables. */
+	ArgVec argv;
+	/* Leading words of argv which were not expanded, e.g. the name and the
+	 * options before "$(cmds)".
+	 * */
+	size_t num_plain;
+	/* Trailing words of argv which were not expanded and follow an expanded
+	 * one, e.g. the destination after "$(cmds)".
+	 * */
+	size_t num_plain_tail;
+	/* Exit value of the last command substitution, -1 if there was none. */
+	int subst_exval;
+	/* Redirections, file names and the here-document are expanded too. */
+	CmdIO io;
+	/* Process substitutions referenced by the words as /dev/fd/N. */
+	ProcSub *procsubs;
+	size_t num_procsubs;
+} CmdExpanded;
+
+/* Expands words of 'cmd' into 'out'. '$NAME', '${NAME}' are replaced with
+ * the variable's value, '$?' with 'exval', '$(cmds)' with the output of
+ * the commands and '$((expr))' with the value of the arithmetic expression,
+ * see arith.h. '$1'...'$9', '${N}' are replaced with the positional
+ * parameters, '$#' with their number, '$@' and '$*' with all of them
+ * separated by spaces, a word consisting only of '$@' or '$*' becomes one
+ * word per parameter. Words with '$(cmds)' are split at whitespace afterwards.
+ * Then the patterns are expanded. '<(cmds)' and '>(cmds)' in the arguments
+ * and the redirected file names start the commands concurrently and are
+ * replaced with /dev/fd/N path of a pipe to their output or input, their
+ * processes join the job being started.
+ * The leading assignments and the redirections are not globbed.
+ * Bodies of the here-documents must have been read already.
+ * Returns false if an arithmetic expansion failed, then the expansion stops
+ * and the command must not run. 'out' is to be freed by expand_free() in
+ * both cases.
+ * */
+bool
+expand_cmd(const CmdSimple *cmd, int exval, CmdExpanded *out);
+
+/* Closes the shell's ends of the process substitutions, e.g. after the
+ * command which uses them has been started.
+ * */
+void
+expand_close_procsubs(CmdExpanded *exp);
+
+/* Frees the expanded words and closes the process substitutions. Their
+ * processes belong to the job being started, see job_begin().
+ * */
+void
+expand_free(CmdExpanded *exp);
+#endif /* ifndef MYSHELL_EXPAND_HEADER */
@@ -0,0 +1,193 @@
+#include "funcs.h"
+
+#include <assert.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmdparsing.h"
+
+#define FUNCS_INIT_BUCKETS 64
+
+/* One function or alias. */
+typedef struct entry_tag {
+	CmdFunc *func;
+	struct entry_tag *next;
+} entry;
+
+static struct {
+	/* Chained hash table keyed by the names. */
+	entry **buckets;
+	size_t num_buckets;
+	size_t count;
+	unsigned long generation;
+} funcs;
+
+/* FNV-1a hash of the name. */
+static uint64_t
+hash_name(const char *name) {
+	uint64_t hash = 14695981039346656037ull;
+	for (; *name; ++name) {
+		hash ^= (unsigned char)*name;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/* Returns the link pointing to the entry, the link is NULL if there is no
+ * such entry.
+ * */
+static entry **
+entry_find(const char *name) {
+	if (funcs.num_buckets == 0)
+		return NULL;
+	entry **link = &funcs.buckets[hash_name(name) & (funcs.num_buckets - 1)];
+	while (*link && strcmp((*link)->func->name, name) != 0)
+		link = &(*link)->next;
+	return link;
+}
+
+/* Doubles the table. */
+static void
+funcs_grow() {
+	size_t old_num = funcs.num_buckets;
+	entry **old = funcs.buckets;
+	funcs.num_buckets = old_num ? old_num * 2 : FUNCS_INIT_BUCKETS;
+	if (!(funcs.buckets = calloc(funcs.num_buckets, sizeof *funcs.buckets)))
+		err(1, "malloc");
+	for (size_t i = 0; i < old_num; ++i)
+		while (old[i]) {
+			entry *e = old[i];
+			old[i] = e->next;
+			entry **bucket = &funcs.buckets[hash_name(e->func->name) &
+											(funcs.num_buckets - 1)];
+			e->next = *bucket;
+			*bucket = e;
+		}
+	free(old);
+}
+
+void
+funcs_define(CmdFunc *func) {
+	assert(func);
+
+	if (funcs.count + 1 > funcs.num_buckets)
+		funcs_grow();
+	entry **link = entry_find(func->name);
+	entry *e = *link;
+	if (e)
+		/* A running call keeps its own reference. */
+		cmd_unref_func(e->func);
+	else {
+		if (!(e = malloc(sizeof *e)))
+			err(1, "malloc");
+		e->next = NULL;
+		*link = e;
+		++funcs.count;
+		++funcs.generation;
+	}
+	e->func = cmd_ref_func(func);
+}
+
+/* Line source of an alias, here-documents have no body. */
+static char *
+no_lines(void *ctx) {
+	(void)ctx;
+	return NULL;
+}
+
+bool
+funcs_alias(const char *name, const char *value) {
+	assert(name);
+	assert(value);
+
+	size_t len = strlen(value) + sizeof " $@";
+	char *line = malloc(len);
+	if (!line)
+		err(1, "malloc");
+	snprintf(line, len, "%s $@", value);
+	char *err_msg = NULL;
+	Cmds *body = parse_line(line, &err_msg);
+	free(line);
+	if (body && !parse_heredocs(body, &no_lines, NULL, &err_msg)) {
+		cmd_free_cmds(body);
+		body = NULL;
+	}
+	if (!body) {
+		warnx("alias: %s: %s", name, err_msg);
+		free(err_msg);
+		return false;
+	}
+	char *name_copy = strdup(name);
+	char *text = strdup(value);
+	if (!name_copy || !text)
+		err(1, "malloc");
+	PipeCmd *def = cmd_alloc_funcdef(name_copy, body);
+	def->func->alias = text;
+	funcs_define(def->func);
+	cmd_free_pipe(def);
+	return true;
+}
+
+bool
+funcs_remove(const char *name, bool alias) {
+	assert(name);
+
+	entry **link = entry_find(name);
+	if (!link || !*link || ((*link)->func->alias != NULL) != alias)
+		return false;
+	entry *e = *link;
+	*link = e->next;
+	--funcs.count;
+	++funcs.generation;
+	cmd_unref_func(e->func);
+	free(e);
+	return true;
+}
+
+CmdFunc *
+funcs_find(const char *name) {
+	assert(name);
+
+	entry **link = entry_find(name);
+	if (!link || !*link)
+		return NULL;
+	CmdFunc *func = (*link)->func;
+	return func->alias && func->running > 0 ? NULL : func;
+}
+
+static int
+cmp_funcs(const void *l, const void *r) {
+	return strcmp((*(CmdFunc *const *)l)->name, (*(CmdFunc *const *)r)->name);
+}
+
+bool
+funcs_print_aliases(int fd, const char *name) {
+	if (name) {
+		entry **link = entry_find(name);
+		if (!link || !*link || !(*link)->func->alias)
+			return false;
+		dprintf(fd, "alias %s=%s\n", name, (*link)->func->alias);
+		return true;
+	}
+	CmdFunc **sorted = malloc((funcs.count + 1) * sizeof *sorted);
+	if (!sorted)
+		err(1, "malloc");
+	size_t count = 0;
+	for (size_t i = 0; i < funcs.num_buckets; ++i)
+		for (entry *e = funcs.buckets[i]; e; e = e->next)
+			if (e->func->alias)
+				sorted[count++] = e->func;
+	qsort(sorted, count, sizeof *sorted, &cmp_funcs);
+	for (size_t i = 0; i < count; ++i)
+		dprintf(fd, "alias %s=%s\n", sorted[i]->name, sorted[i]->alias);
+	free(sorted);
+	return true;
+}
+
+unsigned long
+funcs_generation() {
+	return funcs.generation;
+}
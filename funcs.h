@@ -0,0 +1,49 @@
+#ifndef MYSHELL_FUNCS_HEADER
+#define MYSHELL_FUNCS_HEADER
+
+#include <stdbool.h>
+
+#include "cmdhiearchy.h"
+
+/* Shell functions and aliases.
+ *
+ * Both are kept parsed in a hash table, so a call runs the stored commands
+ * without lexing or parsing them again. An alias is a function whose body
+ * is its text followed by "$@", i.e. the arguments of the call. Functions
+ * and aliases share one namespace, a definition replaces either.
+ * */
+
+/* Defines function 'func->name', a reference to 'func' is taken. */
+void
+funcs_define(CmdFunc *func);
+
+/* Defines alias 'name' for the commands in 'value'. Returns false after
+ * reporting a syntax error.
+ * */
+bool
+funcs_alias(const char *name, const char *value);
+
+/* Removes alias, or function if 'alias' is false, 'name'. Returns false if
+ * there is none.
+ * */
+bool
+funcs_remove(const char *name, bool alias);
+
+/* Returns function or alias 'name', NULL if there is none. An alias is not
+ * found while it runs, so that "alias ls=ls -F" calls the command.
+ * */
+CmdFunc *
+funcs_find(const char *name);
+
+/* Prints "alias name=value" line of alias 'name' into 'fd', all of them
+ * sorted by name if 'name' is NULL. Returns false if there is no such alias.
+ * */
+bool
+funcs_print_aliases(int fd, const char *name);
+
+/* Returns a number which changes whenever a function or an alias is added
+ * or removed, but not when one is redefined.
+ * */
+unsigned long
+funcs_generation();
+#endif /* ifndef MYSHELL_FUNCS_HEADER */
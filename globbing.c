@@ -0,0 +1,438 @@
+#include "globbing.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "dirlist.h"
+
+/* Number of slots of the listing cache, it grows when half full. */
+#define GLOB_CACHE_INIT 64
+
+/* Kinds of single-character matchers, a star matches any run. */
+typedef enum { GLOB_LIT, GLOB_ANY, GLOB_CLASS, GLOB_STAR } glob_op_type;
+
+typedef struct {
+	glob_op_type type;
+	/* GLOB_LIT character. */
+	char c;
+	/* GLOB_CLASS set of the matched bytes, negation is already applied. */
+	uint8_t set[32];
+} glob_op;
+
+/* Compiled pattern of one path component. */
+typedef struct {
+	glob_op *ops;
+	size_t count;
+	/* Leading literal characters, candidates must start with them. */
+	char *prefix;
+	/* Whether the pattern matches names starting with '.'. */
+	bool hidden;
+} glob_pattern;
+
+/* One path component, either literal or a pattern. */
+typedef struct {
+	char *str;
+	bool magic;
+	glob_pattern pat;
+} glob_comp;
+
+/* Cached listing of a directory. */
+typedef struct {
+	/* NULL for an unused slot. */
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	/* Whether the directory can be read. */
+	bool valid;
+	listing list;
+} glob_dir;
+
+static struct {
+	glob_dir *dirs;
+	size_t count;
+	size_t cap;
+} cache;
+
+void
+argvec_push(ArgVec *vec, char *str) {
+	assert(vec);
+
+	/* Keep a place for the terminating NULL. */
+	if (vec->count + 1 >= vec->cap) {
+		vec->cap = vec->cap ? vec->cap * 2 : 16;
+		vec->items = realloc(vec->items, vec->cap * sizeof *vec->items);
+		if (!vec->items)
+			err(1, "malloc");
+	}
+	vec->items[vec->count++] = str;
+	vec->items[vec->count] = NULL;
+}
+
+void
+argvec_free(ArgVec *vec) {
+	assert(vec);
+
+	for (size_t i = 0; i < vec->count; ++i)
+		free(vec->items[i]);
+	free(vec->items);
+	vec->items = NULL;
+	vec->count = 0;
+	vec->cap = 0;
+}
+
+/* Returns position of ']' closing the class which starts at 'str' after
+ * '[', NULL if there is none.
+ * */
+static const char *
+class_end(const char *str, const char *end) {
+	const char *p = str;
+	if (p < end && (*p == '!' || *p == '^'))
+		++p;
+	/* Leading ']' is a member. */
+	if (p < end && *p == ']')
+		++p;
+	while (p < end && *p != ']')
+		++p;
+	return p < end ? p : NULL;
+}
+
+/* Whether [str,end) contains a pattern. */
+static bool
+has_magic(const char *str, const char *end) {
+	for (const char *p = str; p < end; ++p)
+		if (*p == '*' || *p == '?' || (*p == '[' && class_end(p + 1, end)))
+			return true;
+	return false;
+}
+
+bool
+glob_has_magic(const char *word) {
+	assert(word);
+
+	return has_magic(word, word + strlen(word));
+}
+
+/* Compiles the class [str,end) without the brackets into 'op'. */
+static void
+compile_class(const char *str, const char *end, glob_op *op) {
+	bool negate = str < end && (*str == '!' || *str == '^');
+	if (negate)
+		++str;
+	memset(op->set, 0, sizeof op->set);
+	for (const char *p = str; p < end; ++p) {
+		unsigned char from = *p, to = *p;
+		if (p + 2 < end && p[1] == '-') {
+			to = p[2];
+			p += 2;
+		}
+		for (unsigned c = from; c <= to; ++c)
+			op->set[c / 8] |= 1u << (c % 8);
+	}
+	if (negate)
+		for (size_t i = 0; i < sizeof op->set; ++i)
+			op->set[i] = ~op->set[i];
+	op->type = GLOB_CLASS;
+}
+
+/* Compiles the component 'str' into 'pat'. */
+static void
+compile_pattern(const char *str, glob_pattern *pat) {
+	size_t len = strlen(str);
+	if (!(pat->ops = malloc((len + 1) * sizeof *pat->ops)))
+		err(1, "malloc");
+	pat->count = 0;
+	const char *end = str + len;
+	for (const char *p = str; p < end; ++p) {
+		glob_op *op = &pat->ops[pat->count];
+		const char *close;
+		if (*p == '*') {
+			/* Consecutive stars are one. */
+			if (pat->count > 0 && op[-1].type == GLOB_STAR)
+				continue;
+			op->type = GLOB_STAR;
+		} else if (*p == '?')
+			op->type = GLOB_ANY;
+		else if (*p == '[' && (close = class_end(p + 1, end))) {
+			compile_class(p + 1, close, op);
+			p = close;
+		} else {
+			op->type = GLOB_LIT;
+			op->c = *p;
+		}
+		++pat->count;
+	}
+
+	size_t prefix_len = 0;
+	while (prefix_len < pat->count && pat->ops[prefix_len].type == GLOB_LIT)
+		++prefix_len;
+	if (!(pat->prefix = malloc(prefix_len + 1)))
+		err(1, "malloc");
+	for (size_t i = 0; i < prefix_len; ++i)
+		pat->prefix[i] = pat->ops[i].c;
+	pat->prefix[prefix_len] = '\0';
+	pat->hidden = prefix_len > 0 && pat->prefix[0] == '.';
+}
+
+/* Whether one character matches a non-star matcher. */
+static bool
+op_matches(const glob_op *op, unsigned char c) {
+	switch (op->type) {
+	case GLOB_LIT:
+		return (unsigned char)op->c == c;
+	case GLOB_ANY:
+		return true;
+	case GLOB_CLASS:
+		return op->set[c / 8] & (1u << (c % 8));
+	case GLOB_STAR:
+	default:
+		return false;
+	}
+}
+
+/* Whether the whole 'name' matches the pattern. Only the last star is
+ * backtracked to, which is enough as any earlier star could only match
+ * less.
+ * */
+static bool
+pattern_match(const glob_pattern *pat, const char *name) {
+	size_t op = 0;
+	const char *s = name;
+	size_t star_op = SIZE_MAX;
+	const char *star_s = NULL;
+	while (*s) {
+		if (op < pat->count && pat->ops[op].type == GLOB_STAR) {
+			star_op = ++op;
+			star_s = s;
+			continue;
+		}
+		if (op < pat->count && op_matches(&pat->ops[op], *s)) {
+			++op;
+			++s;
+			continue;
+		}
+		if (star_op == SIZE_MAX)
+			return false;
+		/* Let the star match one more character. */
+		op = star_op;
+		s = ++star_s;
+	}
+	while (op < pat->count && pat->ops[op].type == GLOB_STAR)
+		++op;
+	return op == pat->count;
+}
+
+/* FNV-1a hash of the path. */
+static uint64_t
+hash_path(const char *path) {
+	uint64_t hash = 14695981039346656037ull;
+	for (const char *p = path; *p; ++p) {
+		hash ^= (unsigned char)*p;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/* Returns the slot of 'path' in the cache, an unused one if not cached. */
+static glob_dir *
+cache_slot(const char *path) {
+	size_t mask = cache.cap - 1;
+	size_t slot = hash_path(path) & mask;
+	while (cache.dirs[slot].path && strcmp(cache.dirs[slot].path, path) != 0)
+		slot = (slot + 1) & mask;
+	return &cache.dirs[slot];
+}
+
+/* Doubles the cache. */
+static void
+cache_grow() {
+	glob_dir *old = cache.dirs;
+	size_t old_cap = cache.cap;
+	cache.cap = old_cap ? old_cap * 2 : GLOB_CACHE_INIT;
+	if (!(cache.dirs = calloc(cache.cap, sizeof *cache.dirs)))
+		err(1, "malloc");
+	for (size_t i = 0; i < old_cap; ++i)
+		if (old[i].path)
+			*cache_slot(old[i].path) = old[i];
+	free(old);
+}
+
+/* Returns up-to-date listing of directory 'path', NULL if it cannot be
+ * read.
+ * */
+static const listing *
+cache_get(const char *path) {
+	struct stat st;
+	if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode))
+		return NULL;
+	if (2 * (cache.count + 1) > cache.cap)
+		cache_grow();
+	glob_dir *dir = cache_slot(path);
+	if (dir->path) {
+		if (dir->dev == st.st_dev && dir->ino == st.st_ino &&
+			dir->mtime.tv_sec == st.st_mtim.tv_sec &&
+			dir->mtime.tv_nsec == st.st_mtim.tv_nsec)
+			return dir->valid ? &dir->list : NULL;
+	} else {
+		if (!(dir->path = strdup(path)))
+			err(1, "malloc");
+		++cache.count;
+	}
+	dir->dev = st.st_dev;
+	dir->ino = st.st_ino;
+	dir->mtime = st.st_mtim;
+	dir->valid = listing_read(path, &dir->list, false);
+	if (!dir->valid)
+		listing_free(&dir->list);
+	return dir->valid ? &dir->list : NULL;
+}
+
+void
+glob_cache_clear() {
+	for (size_t i = 0; i < cache.cap; ++i)
+		if (cache.dirs[i].path) {
+			free(cache.dirs[i].path);
+			listing_free(&cache.dirs[i].list);
+		}
+	free(cache.dirs);
+	cache.dirs = NULL;
+	cache.count = 0;
+	cache.cap = 0;
+}
+
+/* Returns newly allocated "<base><name><suffix>". */
+static char *
+join_path(const char *base, const char *name, const char *suffix) {
+	size_t len = strlen(base) + strlen(name) + strlen(suffix) + 1;
+	char *path = malloc(len);
+	if (!path)
+		err(1, "malloc");
+	snprintf(path, len, "%s%s%s", base, name, suffix);
+	return path;
+}
+
+/* Whether the listed 'name' in directory 'base' is a directory. */
+static bool
+is_dir(const char *base, const char *name) {
+	unsigned char type = listing_type(name);
+	if (type != DT_LNK && type != DT_UNKNOWN)
+		return type == DT_DIR;
+	char *path = join_path(base, name, "");
+	struct stat st;
+	bool dir = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+	free(path);
+	return dir;
+}
+
+/* State of one expansion. */
+typedef struct {
+	glob_comp *comps;
+	size_t num_comps;
+	/* Whether the pattern ends with '/', i.e. matches only directories. */
+	bool dirs_only;
+	ArgVec *out;
+} glob_state;
+
+/* Matches components from 'comp' onwards in directory 'base', which is
+ * either empty for the current directory or ends with '/'.
+ * */
+static void
+glob_dir_match(glob_state *st, const char *base, size_t comp) {
+	bool last = comp + 1 == st->num_comps;
+	const glob_comp *c = &st->comps[comp];
+	if (!c->magic) {
+		char *path = join_path(base, c->str, last ? "" : "/");
+		struct stat sb;
+		if (!last)
+			glob_dir_match(st, path, comp + 1);
+		else if (st->dirs_only ? stat(path, &sb) == 0 && S_ISDIR(sb.st_mode)
+							   : lstat(path, &sb) == 0)
+			argvec_push(st->out,
+						join_path(base, c->str, st->dirs_only ? "/" : ""));
+		free(path);
+		return;
+	}
+
+	const listing *list = cache_get(*base ? base : ".");
+	if (!list)
+		return;
+	const glob_pattern *pat = &c->pat;
+	size_t prefix_len = strlen(pat->prefix);
+	for (size_t i = listing_lower_bound(list->names, list->count, pat->prefix);
+		 i < list->count; ++i) {
+		const char *name = list->names[i];
+		if (strncmp(name, pat->prefix, prefix_len) != 0)
+			break;
+		if ((name[0] == '.' && !pat->hidden) || !pattern_match(pat, name))
+			continue;
+		if (!last) {
+			/* Entries which are not directories fail to be listed. */
+			char *path = join_path(base, name, "/");
+			glob_dir_match(st, path, comp + 1);
+			free(path);
+		} else if (!st->dirs_only)
+			argvec_push(st->out, join_path(base, name, ""));
+		else if (is_dir(base, name))
+			argvec_push(st->out, join_path(base, name, "/"));
+	}
+}
+
+static int
+cmp_paths(const void *l, const void *r) {
+	return strcmp(*(char *const *)l, *(char *const *)r);
+}
+
+void
+glob_expand(const char *word, ArgVec *out) {
+	assert(word);
+	assert(out);
+
+	char *copy = strdup(word);
+	if (!copy)
+		err(1, "malloc");
+	glob_state st;
+	st.out = out;
+	st.num_comps = 0;
+	if (!(st.comps = malloc((strlen(word) / 2 + 1) * sizeof *st.comps)))
+		err(1, "malloc");
+	/* Absolute patterns are matched from the root. */
+	const char *base = copy[0] == '/' ? "/" : "";
+	char *save;
+	for (char *tok = strtok_r(copy, "/", &save); tok;
+		 tok = strtok_r(NULL, "/", &save)) {
+		glob_comp *c = &st.comps[st.num_comps++];
+		c->str = tok;
+		c->magic = glob_has_magic(tok);
+		if (c->magic)
+			compile_pattern(tok, &c->pat);
+	}
+	size_t len = strlen(word);
+	st.dirs_only = len > 0 && word[len - 1] == '/';
+
+	size_t first = out->count;
+	if (st.num_comps > 0)
+		glob_dir_match(&st, base, 0);
+	if (out->count == first) {
+		char *literal = strdup(word);
+		if (!literal)
+			err(1, "malloc");
+		argvec_push(out, literal);
+	} else
+		qsort(out->items + first, out->count - first, sizeof *out->items,
+			  &cmp_paths);
+
+	for (size_t i = 0; i < st.num_comps; ++i)
+		if (st.comps[i].magic) {
+			free(st.comps[i].pat.ops);
+			free(st.comps[i].pat.prefix);
+		}
+	free(st.comps);
+	free(copy);
+}
@@ -0,0 +1,46 @@
+#ifndef MYSHELL_GLOBBING_HEADER
+#define MYSHELL_GLOBBING_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Pathname expansion of '*', '?' and '[...]' patterns.
+ *
+ * Each component of a pattern is compiled into a matcher once, its literal
+ * prefix narrows the candidates by binary search in the sorted directory
+ * listing. Listings are cached until glob_cache_clear(), so that globs of one
+ * command line read each directory once. Cached listings are validated by
+ * the directory's mtime, so commands which change a directory earlier on the
+ * line are still seen by later globs.
+ * */
+
+/* Growable NULL-terminated array of strings, e.g. argv of a command. */
+typedef struct {
+	char **items;
+	size_t count;
+	size_t cap;
+} ArgVec;
+
+/* Appends 'str' to the vector and claims it, 'str' must be heap-allocated. */
+void
+argvec_push(ArgVec *vec, char *str);
+
+/* Frees the vector and all its strings. */
+void
+argvec_free(ArgVec *vec);
+
+/* Whether 'word' contains a pattern to expand. */
+bool
+glob_has_magic(const char *word);
+
+/* Appends sorted paths matching 'word' to 'out'. Hidden files are only
+ * matched by patterns starting with '.'. If nothing matches, the word itself
+ * is appended.
+ * */
+void
+glob_expand(const char *word, ArgVec *out);
+
+/* Forgets the cached listings. */
+void
+glob_cache_clear();
+#endif /* ifndef MYSHELL_GLOBBING_HEADER */
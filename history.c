@@ -0,0 +1,575 @@
+#define _GNU_SOURCE /* mkostemp */
+#include "history.h"
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <readline/history.h>
+#include <readline/readline.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "histsearch.h"
+#include "vars.h"
+
+#define HIST_DEFAULT_SIZE 1000
+#define HIST_DEFAULT_FILESIZE (1024 * 1024)
+/* Seconds after which compaction that has not replaced the file is deemed
+ * failed and may be started again.
+ * */
+#define HIST_COMPACT_TIMEOUT 30
+
+/* One entry in the history file. */
+typedef struct {
+	/* Offset of the entry's text in the file. */
+	size_t off;
+	size_t len;
+} hist_rec;
+
+/* State of the persistent history. */
+static struct {
+	/* Path to the history file, NULL if the persistent history is disabled.*/
+	char *path;
+	/* Descriptor of the opened file, -1 if not opened yet. */
+	int fd;
+	/* Inode of the opened file, the file is replaced on compaction. */
+	ino_t ino;
+	/* Known size of the file. */
+	size_t file_len;
+	/* Maximum number of entries in readline's list. */
+	size_t max_entries;
+	/* Size of the file that triggers compaction. */
+	size_t max_file_len;
+	/* Whether compaction of the opened file has already been started. */
+	bool compacting;
+	/* When the compaction was started. */
+	time_t compact_start;
+	/* Whether the file has been loaded into readline's list. */
+	bool loaded;
+	/* The file has been replaced, its entries are indexed for the search
+	 * again but not imported into readline's list.
+	 * */
+	bool reindex;
+	/* Mapped prefix [0,map_len) of the file. */
+	char *map;
+	size_t map_len;
+	/* Index of the entries in the file. */
+	hist_rec *recs;
+	size_t count;
+	size_t cap;
+	/* End of the indexed part of the file, everything after it has been
+	 * written since the last time this session read the file. */
+	size_t read_end;
+	/* End offsets of records appended by this session which are past
+	 * 'read_end'. These are already in readline's list and are not imported.
+	 * */
+	size_t *own_ends;
+	size_t own_count;
+	size_t own_cap;
+} hist = {NULL, -1, 0, 0, 0, 0, false, 0, false, false, NULL, 0,
+		  NULL, 0, 0, 0, NULL, 0, 0};
+
+/* Result of parsing one record of the history file. */
+typedef enum {
+	HIST_REC_OK,
+	/* The record has not been fully written yet. */
+	HIST_REC_PARTIAL,
+	/* The record is corrupted and is skipped. */
+	HIST_REC_BAD,
+} hist_rec_status;
+
+/* Reads unsigned number from 'var' env. variable, returns 'def' if it is not
+ * set or is not a valid positive number.
+ * */
+static size_t
+env_size(const char *var, size_t def) {
+	const char *val = vars_get(var);
+	if (!val || *val == '\0')
+		return def;
+	char *end;
+	errno = 0;
+	unsigned long long num = strtoull(val, &end, 10);
+	if (errno != 0 || *end != '\0' || num == 0)
+		return def;
+	return num;
+}
+
+/* Returns malloced path to the history file or NULL if there is none. */
+static char *
+hist_file_path() {
+	const char *file = vars_get("MYSH_HISTFILE");
+	if (file)
+		return *file ? strdup(file) : NULL;
+	const char *home = vars_get("HOME");
+	if (!home)
+		return NULL;
+	const char *name = "/.mysh_history";
+	char *path = malloc(strlen(home) + strlen(name) + 1);
+	if (!path)
+		err(1, "malloc");
+	strcpy(path, home);
+	strcat(path, name);
+	return path;
+}
+
+/* Unmaps the file and forgets the index. */
+static void
+hist_unmap() {
+	if (hist.map)
+		munmap(hist.map, hist.map_len);
+	hist.map = NULL;
+	hist.map_len = 0;
+	hist.count = 0;
+	hist.read_end = 0;
+	hist.own_count = 0;
+}
+
+/* Disables the persistent history after an unrecoverable error. */
+static void
+hist_disable() {
+	hist_unmap();
+	if (hist.fd != -1)
+		close(hist.fd);
+	hist.fd = -1;
+	free(hist.path);
+	hist.path = NULL;
+}
+
+/* Opens the history file if it is not already opened.
+ * Returns whether the file is opened.
+ * */
+static bool
+hist_open() {
+	if (hist.fd != -1)
+		return true;
+	if (!hist.path)
+		return false;
+
+	int fd = open(hist.path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		warn("history: cannot open \"%s\"", hist.path);
+		if (fd != -1)
+			close(fd);
+		hist_disable();
+		return false;
+	}
+	hist.fd = fd;
+	hist.ino = st.st_ino;
+	hist.file_len = st.st_size;
+	hist.compacting = false;
+	return true;
+}
+
+/* Checks whether the opened file has been replaced by compaction and reopens
+ * it if so. The index of the old file is dropped, the search index is
+ * rebuilt from the new one, which keeps only some of the entries.
+ * Returns true if the file has been reopened.
+ * */
+static bool
+hist_reopen_replaced() {
+	struct stat st;
+	if (hist.fd == -1 || (stat(hist.path, &st) == 0 && st.st_ino == hist.ino))
+		return false;
+	hist_unmap();
+	hsearch_clear();
+	hist.reindex = true;
+	close(hist.fd);
+	hist.fd = -1;
+	hist_open();
+	return true;
+}
+
+/* Maps whole [0,file_len) part of the file. Returns false on error. */
+static bool
+hist_map() {
+	if (hist.map_len == hist.file_len)
+		return true;
+	if (hist.map)
+		munmap(hist.map, hist.map_len);
+	hist.map = NULL;
+	hist.map_len = 0;
+	if (hist.file_len == 0)
+		return true;
+	void *map = mmap(NULL, hist.file_len, PROT_READ, MAP_SHARED, hist.fd, 0);
+	if (map == MAP_FAILED) {
+		warn("history: cannot map \"%s\"", hist.path);
+		return false;
+	}
+	hist.map = map;
+	hist.map_len = hist.file_len;
+	return true;
+}
+
+/* Parses one record starting at 'pos' of the mapped file.
+ * Records are framed as ":LEN:TEXT\n", where LEN is the decimal length of the
+ * TEXT that cannot contain newlines. Lines without the header are accepted
+ * as they are. On HIST_REC_OK 'rec' is filled in, except for
+ * HIST_REC_PARTIAL '*next' is set to the start of the next record.
+ * */
+static hist_rec_status
+hist_parse_rec(size_t pos, hist_rec *rec, size_t *next) {
+	const char *start = hist.map + pos;
+	const char *nl = memchr(start, '\n', hist.map_len - pos);
+	/* Every record ends with a newline, even a corrupted one is skipped only
+	 * once the next newline is written. */
+	if (!nl)
+		return HIST_REC_PARTIAL;
+	*next = nl - hist.map + 1;
+
+	size_t line_len = nl - start;
+	if (*start != ':') {
+		rec->off = pos;
+		rec->len = line_len;
+		return HIST_REC_OK;
+	}
+	size_t len = 0;
+	size_t i = 1;
+	for (; i < line_len && i < 12 && start[i] >= '0' && start[i] <= '9'; ++i)
+		len = len * 10 + (start[i] - '0');
+	/* Interleaved or truncated write would put the newline elsewhere. */
+	if (i == 1 || i >= line_len || start[i] != ':' || line_len != i + 1 + len)
+		return HIST_REC_BAD;
+	rec->off = pos + i + 1;
+	rec->len = len;
+	return HIST_REC_OK;
+}
+
+/* Whether the record ending at 'end' has been appended by this session. */
+static bool
+hist_is_own(size_t end) {
+	for (size_t i = 0; i < hist.own_count; ++i)
+		if (hist.own_ends[i] == end) {
+			hist.own_ends[i] = hist.own_ends[--hist.own_count];
+			return true;
+		}
+	return false;
+}
+
+/* Adds the entry to readline's list. */
+static void
+hist_add_readline(const hist_rec *rec) {
+	char *line = malloc(rec->len + 1);
+	if (!line)
+		err(1, "malloc");
+	memcpy(line, hist.map + rec->off, rec->len);
+	line[rec->len] = '\0';
+	add_history(line);
+	free(line);
+}
+
+/* Extends the index over the whole file. Entries written by other sessions
+ * are imported into readline's list if 'import' is set.
+ * Returns false on error.
+ * */
+static bool
+hist_index(bool import) {
+	struct stat st;
+	if (fstat(hist.fd, &st) == -1)
+		return false;
+	hist.file_len = st.st_size;
+	if (!hist_map())
+		return false;
+
+	size_t pos = hist.read_end;
+	while (pos < hist.map_len) {
+		hist_rec rec;
+		size_t next;
+		hist_rec_status status = hist_parse_rec(pos, &rec, &next);
+		if (status == HIST_REC_PARTIAL)
+			break;
+		pos = next;
+		if (status == HIST_REC_BAD)
+			continue;
+		if (hist.count == hist.cap) {
+			size_t new_cap = hist.cap ? hist.cap * 2 : 1024;
+			hist_rec *recs = realloc(hist.recs, new_cap * sizeof *recs);
+			if (!recs)
+				err(1, "malloc");
+			hist.recs = recs;
+			hist.cap = new_cap;
+		}
+		hist.recs[hist.count++] = rec;
+		/* Own entries are indexed by hist_add() once loaded, before that
+		 * none are recorded.
+		 * */
+		bool own = hist_is_own(pos);
+		if (!own)
+			hsearch_add(hist.map + rec.off, rec.len);
+		if (!own && import)
+			hist_add_readline(&rec);
+	}
+	hist.read_end = pos;
+	hist.reindex = false;
+	return true;
+}
+
+/* Rewrites the history file to only contain its newest entries that fit into
+ * the half of the maximum size. Meant to run in a detached process.
+ * Appenders are kept out by exclusive lock of the old file until it is
+ * replaced.
+ * */
+static void
+hist_compact_file() {
+	int fd = open(hist.path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || flock(fd, LOCK_EX | LOCK_NB) == -1)
+		return;
+	struct stat st, path_st;
+	if (fstat(fd, &st) == -1 || stat(hist.path, &path_st) == -1 ||
+		st.st_ino != path_st.st_ino || (size_t)st.st_size <= hist.max_file_len)
+		return; /* Somebody else has already compacted the file. */
+
+	size_t size = st.st_size;
+	char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return;
+	/* Start at the first entry that fits into the new file. */
+	size_t start = size - hist.max_file_len / 2;
+	const char *nl = memchr(map + start - 1, '\n', size - start + 1);
+	start = nl ? (size_t)(nl - map + 1) : size;
+
+	size_t tmp_len = strlen(hist.path) + sizeof ".XXXXXX";
+	char *tmp = malloc(tmp_len);
+	if (!tmp)
+		return;
+	snprintf(tmp, tmp_len, "%s.XXXXXX", hist.path);
+	int tmp_fd = mkostemp(tmp, O_CLOEXEC);
+	if (tmp_fd == -1)
+		return;
+	size_t pos = start;
+	while (pos < size) {
+		ssize_t num_written = write(tmp_fd, map + pos, size - pos);
+		if (num_written == -1 && errno != EINTR)
+			break;
+		pos += num_written > 0 ? num_written : 0;
+	}
+	if (pos != size || fsync(tmp_fd) == -1 || rename(tmp, hist.path) == -1)
+		unlink(tmp);
+}
+
+/* Starts compaction of the history file in a detached process. */
+static void
+hist_compact() {
+	hist.compacting = true;
+	hist.compact_start = time(NULL);
+	pid_t pid = fork();
+	if (pid == -1) {
+		warn("history: cannot start compaction (fork)");
+		return;
+	} else if (pid == 0) {
+		/* Double fork so that the shell never waits for the compaction. */
+		if (fork() == 0) {
+			setsid();
+			hist_compact_file();
+		}
+		_exit(0);
+	}
+	while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+		;
+}
+
+/* Writes a whole record into the history file. Returns false on error. */
+static bool
+hist_write(const char *rec, size_t len) {
+	/* Shared lock only excludes compaction, O_APPEND writes do not need any
+	 * other synchronization with other sessions as long as the record is
+	 * written at once. Compaction could replace the file while waiting for
+	 * the lock, in which case the write goes to the new file instead. */
+	do {
+		if (flock(hist.fd, LOCK_SH) == -1)
+			return false;
+	} while (hist_reopen_replaced() && hist.fd != -1);
+	if (hist.fd == -1)
+		return false;
+
+	size_t pos = 0;
+	while (pos < len) {
+		ssize_t num_written = write(hist.fd, rec + pos, len - pos);
+		if (num_written == -1) {
+			if (errno == EINTR)
+				continue;
+			flock(hist.fd, LOCK_UN);
+			return false;
+		}
+		pos += num_written;
+	}
+	/* O_APPEND moved the offset right after the record. */
+	off_t end = lseek(hist.fd, 0, SEEK_CUR);
+	flock(hist.fd, LOCK_UN);
+	if (end != -1 && hist.loaded) {
+		if (hist.own_count == hist.own_cap) {
+			hist.own_cap = hist.own_cap ? hist.own_cap * 2 : 16;
+			hist.own_ends =
+				realloc(hist.own_ends, hist.own_cap * sizeof *hist.own_ends);
+			if (!hist.own_ends)
+				err(1, "malloc");
+		}
+		hist.own_ends[hist.own_count++] = end;
+	}
+	if (end != -1 && (size_t)end > hist.file_len)
+		hist.file_len = end;
+	return true;
+}
+
+/* Wrappers around readline's history commands which load the history file
+ * before they are first used.
+ * */
+#define LAZY_HIST_COMMAND(name, func)                                          \
+	static int name(int count, int key) {                                      \
+		hist_load();                                                           \
+		return func(count, key);                                               \
+	}
+LAZY_HIST_COMMAND(lazy_previous_history, rl_get_previous_history)
+LAZY_HIST_COMMAND(lazy_beginning_of_history, rl_beginning_of_history)
+LAZY_HIST_COMMAND(lazy_reverse_search_history, rl_reverse_search_history)
+LAZY_HIST_COMMAND(lazy_history_search_backward, rl_history_search_backward)
+LAZY_HIST_COMMAND(lazy_noninc_reverse_search, rl_noninc_reverse_search)
+#undef LAZY_HIST_COMMAND
+
+/* Rebinds all key sequences bound to 'orig' to 'lazy'. */
+static void
+hist_rebind(rl_command_func_t *orig, rl_command_func_t *lazy) {
+	char **seqs = rl_invoking_keyseqs(orig);
+	if (!seqs)
+		return;
+	for (char **seq = seqs; *seq; ++seq) {
+		/* Sequences from the meta keymap are reported as "\M-x" which would
+		 * be bound as a single 8-bit character, "\ex" is what they mean. */
+		char *keys = *seq;
+		if (strncmp(keys, "\\M-", 3) == 0) {
+			keys += 1;
+			memcpy(keys, "\\e", 2);
+		}
+		rl_bind_keyseq(keys, lazy);
+		free(*seq);
+	}
+	free(seqs);
+}
+
+/* Reads the limits of the history again, they may have been changed since
+ * they were last used.
+ * */
+static void
+hist_read_limits() {
+	hist.max_entries = env_size("MYSH_HISTSIZE", HIST_DEFAULT_SIZE);
+	hist.max_file_len = env_size("MYSH_HISTFILESIZE", HIST_DEFAULT_FILESIZE);
+	stifle_history(hist.max_entries);
+}
+
+void
+hist_init() {
+	hist_read_limits();
+	hist.path = hist_file_path();
+
+	/* Reads inputrc, so that user's bindings are rebound too. */
+	rl_initialize();
+	hist_rebind(rl_get_previous_history, lazy_previous_history);
+	hist_rebind(rl_beginning_of_history, lazy_beginning_of_history);
+	hist_rebind(rl_reverse_search_history, lazy_reverse_search_history);
+	hist_rebind(rl_history_search_backward, lazy_history_search_backward);
+	hist_rebind(rl_noninc_reverse_search, lazy_noninc_reverse_search);
+}
+
+void
+hist_add(const char *line) {
+	assert(line);
+
+	assert(!strchr(line, '\n'));
+
+	hist_read_limits();
+	/* Entries of other sessions entered while this line was being typed
+	 * precede it. */
+	hist_sync();
+	add_history(line);
+	size_t len = strlen(line);
+	if (!hist_open()) {
+		hsearch_add(line, len);
+		return;
+	}
+
+	/* Header, text and the newline. */
+	size_t rec_cap = len + 24;
+	char *rec = malloc(rec_cap);
+	if (!rec)
+		err(1, "malloc");
+	int rec_len = snprintf(rec, rec_cap, ":%zu:%s\n", len, line);
+	assert(rec_len > 0 && (size_t)rec_len < rec_cap);
+	if (!hist_write(rec, rec_len) && hist.fd != -1) {
+		warn("history: cannot write to \"%s\"", hist.path);
+		hist_disable();
+	}
+	free(rec);
+	/* Otherwise the entry is indexed with the rest of the file. */
+	if (hist.loaded || hist.fd == -1)
+		hsearch_add(line, len);
+
+	/* A replaced file would have been reopened by hist_write(), so the
+	 * compaction failed, e.g. it could not lock or rename the file.
+	 * */
+	if (hist.compacting &&
+		time(NULL) - hist.compact_start >= HIST_COMPACT_TIMEOUT)
+		hist.compacting = false;
+	if (hist.fd != -1 && !hist.compacting && hist.file_len > hist.max_file_len)
+		hist_compact();
+}
+
+void
+hist_load() {
+	if (hist.loaded)
+		return;
+	hist.loaded = true;
+	hist_read_limits();
+	if (!hist_open() || !hist_index(false))
+		return;
+
+	/* Entries of this session are already in the file. */
+	clear_history();
+	size_t first = hist.count > hist.max_entries ? hist.count - hist.max_entries
+												 : 0;
+	for (size_t i = first; i < hist.count; ++i)
+		hist_add_readline(&hist.recs[i]);
+	/* Current position is at the end of the history again. */
+	using_history();
+}
+
+void
+hist_sync() {
+	if (!hist.loaded || hist.fd == -1)
+		return;
+	/* The offsets into the replaced file are meaningless, the new file is
+	 * only indexed as it is not known what has been read already. It may
+	 * have been replaced by hist_write() too. */
+	hist_reopen_replaced();
+	struct stat st;
+	if (hist.fd == -1 || fstat(hist.fd, &st) == -1 ||
+		(size_t)st.st_size == hist.read_end)
+		return;
+	hist_index(!hist.reindex);
+	using_history();
+}
+
+size_t
+hist_count() {
+	hist_load();
+	hist_sync();
+	return hist.count;
+}
+
+const char *
+hist_entry(size_t i, size_t *len) {
+	assert(i < hist.count);
+	assert(len);
+
+	*len = hist.recs[i].len;
+	return hist.map + hist.recs[i].off;
+}
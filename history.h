@@ -0,0 +1,53 @@
+#ifndef MYSHELL_HISTORY_HEADER
+#define MYSHELL_HISTORY_HEADER
+
+#include <stddef.h>
+
+/* Persistent command history.
+ *
+ * Entries are appended to a log file (MYSH_HISTFILE, defaults to
+ * ~/.mysh_history), one framed record per line. The file can be shared by
+ * many sessions, each record is appended by a single O_APPEND write and
+ * the sessions import each other's records incrementally, the file is never
+ * rewritten except for compaction. The file is never read at startup,
+ * it is mmaped and indexed only on the first access to the history. Once the
+ * file grows past MYSH_HISTFILESIZE bytes it is compacted by a background
+ * process which keeps only the newest entries. readline's in-memory list is
+ * capped to MYSH_HISTSIZE entries.
+ * */
+
+/* Prepares the history, does not touch the history file.
+ * Must be called before readline() is first called.
+ * */
+void
+hist_init();
+
+/* Appends one line to the history, both in-memory and in the file.
+ * 'line' must not contain newlines.
+ * */
+void
+hist_add(const char *line);
+
+/* Loads the history file into readline's list if it has not been loaded
+ * already.
+ * */
+void
+hist_load();
+
+/* Imports entries appended to the history file by other sessions since the
+ * last call. Does nothing if the file has not been loaded yet.
+ * */
+void
+hist_sync();
+
+/* Returns number of entries in the history file, loads it if necessary. */
+size_t
+hist_count();
+
+/* Returns i-th entry of the history file and sets *len to its length.
+ * The string is NOT null-terminated and is valid only until next call to
+ * any hist_ function. 'i' must be less than hist_count().
+ * */
+const char *
+hist_entry(size_t i, size_t *len);
+#endif /* ifndef MYSHELL_HISTORY_HEADER */
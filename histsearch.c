@@ -0,0 +1,418 @@
+#define _GNU_SOURCE /* strcasestr */
+#include "histsearch.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <readline/readline.h>
+
+#include "history.h"
+#include "stats.h"
+
+#define HS_MAX_RESULTS 32
+/* Number of the newest lines searched by queries too short for trigrams. */
+#define HS_SCAN_LIMIT 100000
+/* Lines contain at least this fraction of query's trigrams to be fuzzy
+ * matches. */
+#define HS_FUZZY_NUM 2
+#define HS_FUZZY_DEN 3
+
+/* One distinct line. */
+typedef struct {
+	char *text;
+	uint32_t len;
+	/* Number of uses. */
+	uint32_t count;
+	/* Sequence number of the last use. */
+	uint64_t last;
+} hs_entry;
+
+/* Sorted ids of lines containing one trigram. */
+typedef struct {
+	/* Case-folded trigram with bit 24 set, 0 for an unused slot. */
+	uint32_t key;
+	uint32_t count;
+	uint32_t cap;
+	uint32_t *ids;
+} hs_posting;
+
+static struct {
+	hs_entry *entries;
+	uint32_t count;
+	uint32_t cap;
+	/* Open addressing set of line ids+1, 0 is an empty slot. */
+	uint32_t *lines;
+	size_t lines_cap;
+	/* Open addressing map of the postings. */
+	hs_posting *postings;
+	size_t postings_count;
+	size_t postings_cap;
+	/* Sequence number of the last use. */
+	uint64_t seq;
+	/* Scratch counters for fuzzy matching, one per line. */
+	uint8_t *hits;
+	uint32_t hits_cap;
+} hs;
+
+/* FNV-1a hash of the line. */
+static uint64_t
+hash_line(const char *line, size_t len) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= (unsigned char)line[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static uint64_t
+hash_trigram(uint32_t key) {
+	return key * 0x9E3779B97F4A7C15ull >> 20;
+}
+
+/* Returns case-folded key of the trigram starting at 'str'. */
+static uint32_t
+trigram_key(const char *str) {
+	return 1u << 24 | (uint32_t)tolower((unsigned char)str[0]) << 16 |
+		   (uint32_t)tolower((unsigned char)str[1]) << 8 |
+		   (uint32_t)tolower((unsigned char)str[2]);
+}
+
+/* Returns slot of the line in hs.lines, either the one with its id or an
+ * empty one.
+ * */
+static size_t
+lines_slot(const char *line, size_t len) {
+	size_t mask = hs.lines_cap - 1;
+	size_t slot = hash_line(line, len) & mask;
+	while (hs.lines[slot] != 0) {
+		const hs_entry *entry = &hs.entries[hs.lines[slot] - 1];
+		if (entry->len == len && memcmp(entry->text, line, len) == 0)
+			break;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+/* Doubles the line set. */
+static void
+lines_grow() {
+	size_t old_cap = hs.lines_cap;
+	uint32_t *old = hs.lines;
+	hs.lines_cap = old_cap ? old_cap * 2 : 1024;
+	hs.lines = calloc(hs.lines_cap, sizeof *hs.lines);
+	if (!hs.lines)
+		err(1, "malloc");
+	for (size_t i = 0; i < old_cap; ++i)
+		if (old[i] != 0) {
+			const hs_entry *entry = &hs.entries[old[i] - 1];
+			hs.lines[lines_slot(entry->text, entry->len)] = old[i];
+		}
+	free(old);
+}
+
+/* Returns the posting list of 'key', an empty slot if there is none. */
+static hs_posting *
+postings_find(uint32_t key) {
+	size_t mask = hs.postings_cap - 1;
+	size_t slot = hash_trigram(key) & mask;
+	while (hs.postings[slot].key != 0 && hs.postings[slot].key != key)
+		slot = (slot + 1) & mask;
+	return &hs.postings[slot];
+}
+
+/* Doubles the posting map. */
+static void
+postings_grow() {
+	size_t old_cap = hs.postings_cap;
+	hs_posting *old = hs.postings;
+	hs.postings_cap = old_cap ? old_cap * 2 : 4096;
+	hs.postings = calloc(hs.postings_cap, sizeof *hs.postings);
+	if (!hs.postings)
+		err(1, "malloc");
+	for (size_t i = 0; i < old_cap; ++i)
+		if (old[i].key != 0)
+			*postings_find(old[i].key) = old[i];
+	free(old);
+}
+
+/* Adds line 'id' to the posting list of every trigram of the line. */
+static void
+index_trigrams(uint32_t id) {
+	const hs_entry *entry = &hs.entries[id];
+	for (uint32_t i = 0; i + 3 <= entry->len; ++i) {
+		if (2 * (hs.postings_count + 1) > hs.postings_cap)
+			postings_grow();
+		uint32_t key = trigram_key(entry->text + i);
+		hs_posting *posting = postings_find(key);
+		if (posting->key == 0) {
+			posting->key = key;
+			++hs.postings_count;
+		}
+		/* Ids are added in increasing order, so a repeated trigram of the
+		 * same line is the last one. */
+		if (posting->count > 0 && posting->ids[posting->count - 1] == id)
+			continue;
+		if (posting->count == posting->cap) {
+			posting->cap = posting->cap ? posting->cap * 2 : 4;
+			posting->ids =
+				realloc(posting->ids, posting->cap * sizeof *posting->ids);
+			if (!posting->ids)
+				err(1, "malloc");
+		}
+		posting->ids[posting->count++] = id;
+	}
+}
+
+void
+hsearch_add(const char *line, size_t len) {
+	assert(line);
+
+	if (len == 0)
+		return;
+	++hs.seq;
+	if (2 * (hs.count + 1) > hs.lines_cap)
+		lines_grow();
+	size_t slot = lines_slot(line, len);
+	if (hs.lines[slot] != 0) {
+		hs_entry *entry = &hs.entries[hs.lines[slot] - 1];
+		++entry->count;
+		entry->last = hs.seq;
+		return;
+	}
+
+	if (hs.count == hs.cap) {
+		hs.cap = hs.cap ? hs.cap * 2 : 1024;
+		hs.entries = realloc(hs.entries, hs.cap * sizeof *hs.entries);
+		if (!hs.entries)
+			err(1, "malloc");
+	}
+	hs_entry *entry = &hs.entries[hs.count];
+	if (!(entry->text = strndup(line, len)))
+		err(1, "malloc");
+	entry->len = len;
+	entry->count = 1;
+	entry->last = hs.seq;
+	hs.lines[slot] = ++hs.count;
+	index_trigrams(hs.count - 1);
+}
+
+void
+hsearch_clear() {
+	for (uint32_t i = 0; i < hs.count; ++i)
+		free(hs.entries[i].text);
+	for (size_t i = 0; i < hs.postings_cap; ++i)
+		free(hs.postings[i].ids);
+	free(hs.entries);
+	free(hs.lines);
+	free(hs.postings);
+	free(hs.hits);
+	hs.entries = NULL;
+	hs.count = hs.cap = 0;
+	hs.lines = NULL;
+	hs.lines_cap = 0;
+	hs.postings = NULL;
+	hs.postings_count = hs.postings_cap = 0;
+	hs.hits = NULL;
+	hs.hits_cap = 0;
+}
+
+/* Returns rank of the line, higher is better. Frequency counts
+ * logarithmically, recency decays with the number of newer lines.
+ * */
+static double
+score(uint32_t id) {
+	const hs_entry *entry = &hs.entries[id];
+	int freq = 0;
+	for (uint32_t count = entry->count; count; count >>= 1)
+		++freq;
+	return freq / (1.0 + (hs.seq - entry->last) / 64.0);
+}
+
+/* Best results found so far, sorted by score. */
+typedef struct {
+	uint32_t ids[HS_MAX_RESULTS];
+	double scores[HS_MAX_RESULTS];
+	size_t count;
+	size_t max;
+} top_results;
+
+/* Offers line 'id' with 'score' to the results. */
+static void
+top_offer(top_results *top, uint32_t id, double score) {
+	if (top->count == top->max && score <= top->scores[top->count - 1])
+		return;
+	size_t i = top->count < top->max ? top->count++ : top->count - 1;
+	for (; i > 0 && top->scores[i - 1] < score; --i) {
+		top->scores[i] = top->scores[i - 1];
+		top->ids[i] = top->ids[i - 1];
+	}
+	top->scores[i] = score;
+	top->ids[i] = id;
+}
+
+/* Whether sorted 'posting' contains 'id'. */
+static bool
+posting_contains(const hs_posting *posting, uint32_t id) {
+	uint32_t lo = 0, hi = posting->count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (posting->ids[mid] < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < posting->count && posting->ids[lo] == id;
+}
+
+static int
+cmp_postings(const void *l, const void *r) {
+	uint32_t lhs = (*(hs_posting *const *)l)->count;
+	uint32_t rhs = (*(hs_posting *const *)r)->count;
+	return lhs < rhs ? -1 : lhs > rhs;
+}
+
+/* Finds lines containing 'query' by intersecting the posting lists of its
+ * trigrams. The trigrams' postings are in 'postings', NULL if a trigram
+ * does not appear anywhere.
+ * */
+static void
+find_substring(const char *query, hs_posting **postings, size_t num,
+			   top_results *top) {
+	for (size_t i = 0; i < num; ++i)
+		if (!postings[i])
+			return;
+	/* Start with the shortest list, the others are only probed. */
+	qsort(postings, num, sizeof *postings, &cmp_postings);
+	const hs_posting *first = postings[0];
+	for (uint32_t i = 0; i < first->count; ++i) {
+		uint32_t id = first->ids[i];
+		size_t j = 1;
+		while (j < num && posting_contains(postings[j], id))
+			++j;
+		if (j == num && strcasestr(hs.entries[id].text, query))
+			top_offer(top, id, score(id));
+	}
+}
+
+/* Finds lines sharing most of the trigrams with the query. */
+static void
+find_fuzzy(hs_posting **postings, size_t num, top_results *top) {
+	if (hs.hits_cap < hs.count) {
+		free(hs.hits);
+		hs.hits_cap = hs.cap;
+		if (!(hs.hits = calloc(hs.hits_cap, sizeof *hs.hits)))
+			err(1, "malloc");
+	}
+	size_t min_hits = (num * HS_FUZZY_NUM + HS_FUZZY_DEN - 1) / HS_FUZZY_DEN;
+	for (size_t i = 0; i < num; ++i)
+		if (postings[i])
+			for (uint32_t j = 0; j < postings[i]->count; ++j) {
+				uint32_t id = postings[i]->ids[j];
+				if (hs.hits[id] < UINT8_MAX)
+					++hs.hits[id];
+			}
+	/* Collect the candidates and clear the counters for the next query. */
+	for (size_t i = 0; i < num; ++i)
+		if (postings[i])
+			for (uint32_t j = 0; j < postings[i]->count; ++j) {
+				uint32_t id = postings[i]->ids[j];
+				if (hs.hits[id] >= min_hits)
+					top_offer(top, id, score(id) * hs.hits[id] / num);
+				hs.hits[id] = 0;
+			}
+}
+
+size_t
+hsearch_find(const char *query, const char **results, size_t max) {
+	assert(query);
+	assert(results);
+
+	uint64_t start = stats_now();
+	top_results top;
+	top.count = 0;
+	top.max = max < HS_MAX_RESULTS ? max : HS_MAX_RESULTS;
+	size_t len = strlen(query);
+
+	if (len >= 3) {
+		/* Distinct trigrams of the query. */
+		size_t num = 0;
+		hs_posting **postings = malloc((len - 2) * sizeof *postings);
+		uint32_t *keys = malloc((len - 2) * sizeof *keys);
+		if (!postings || !keys)
+			err(1, "malloc");
+		for (size_t i = 0; i + 3 <= len; ++i) {
+			uint32_t key = trigram_key(query + i);
+			size_t j = 0;
+			while (j < num && keys[j] != key)
+				++j;
+			if (j < num)
+				continue;
+			keys[num] = key;
+			hs_posting *posting = hs.postings_cap ? postings_find(key) : NULL;
+			postings[num++] = posting && posting->key ? posting : NULL;
+		}
+		find_substring(query, postings, num, &top);
+		if (top.count == 0)
+			find_fuzzy(postings, num, &top);
+		free(postings);
+		free(keys);
+	} else if (len > 0) {
+		/* Too short for the index, only the newest lines are searched. */
+		uint32_t end = hs.count > HS_SCAN_LIMIT ? hs.count - HS_SCAN_LIMIT : 0;
+		for (uint32_t id = hs.count; id-- > end;)
+			if (strcasestr(hs.entries[id].text, query))
+				top_offer(&top, id, score(id));
+	}
+
+	for (size_t i = 0; i < top.count; ++i)
+		results[i] = hs.entries[top.ids[i]].text;
+	stats_record("hsearch", stats_now() - start);
+	return top.count;
+}
+
+/* State of the repeated C-r. */
+static struct {
+	const char *results[HS_MAX_RESULTS];
+	size_t count;
+	size_t next;
+	/* The line before the search, restored after the last result. */
+	char *query;
+} cycle;
+
+/* Readline command, replaces the line with the next match for it. */
+static int
+fuzzy_history_search(int count, int key) {
+	(void)count;
+	(void)key;
+	if (rl_last_func != &fuzzy_history_search || !cycle.query) {
+		hist_load();
+		free(cycle.query);
+		if (!(cycle.query = strdup(rl_line_buffer)))
+			err(1, "malloc");
+		cycle.count = hsearch_find(cycle.query, cycle.results, HS_MAX_RESULTS);
+		cycle.next = 0;
+	}
+	if (cycle.next < cycle.count)
+		rl_replace_line(cycle.results[cycle.next++], 0);
+	else {
+		/* Back to the original line. */
+		rl_replace_line(cycle.query, 0);
+		cycle.next = 0;
+		rl_ding();
+	}
+	rl_point = rl_end;
+	return 0;
+}
+
+void
+hsearch_init() {
+	rl_add_defun("fuzzy-history-search", &fuzzy_history_search, -1);
+	rl_bind_keyseq("\\C-r", &fuzzy_history_search);
+}
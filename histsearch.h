@@ -0,0 +1,38 @@
+#ifndef MYSHELL_HISTSEARCH_HEADER
+#define MYSHELL_HISTSEARCH_HEADER
+
+#include <stddef.h>
+
+/* Fuzzy search in the history backed by a trigram index.
+ *
+ * Every distinct line is indexed once by its case-folded trigrams, repeated
+ * lines only update their frequency and last use. A query is answered by
+ * intersecting posting lists of its trigrams, if nothing contains the query
+ * as a substring, lines sharing most of its trigrams are returned instead.
+ * The results are ranked by recency and frequency. Search latency is
+ * recorded into the "hsearch" stats tracker.
+ * */
+
+/* Adds one use of 'line' to the index, 'len' is its length. */
+void
+hsearch_add(const char *line, size_t len);
+
+/* Removes all lines from the index, e.g. to rebuild it from a compacted
+ * history file.
+ * */
+void
+hsearch_clear();
+
+/* Finds at most 'max' best lines matching 'query' and stores them into
+ * 'results', best first. Returns the number of the results. The strings are
+ * valid until the next hsearch_add() call.
+ * */
+size_t
+hsearch_find(const char *query, const char **results, size_t max);
+
+/* Installs readline command bound to C-r which replaces the line with the
+ * best match for its contents, repeating it cycles through other matches.
+ * */
+void
+hsearch_init();
+#endif /* ifndef MYSHELL_HISTSEARCH_HEADER */
@@ -0,0 +1,675 @@
+#include "jobs.h"
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#include "rlimits.h"
+#include "signals.h"
+
+typedef enum { PROC_RUNNING, PROC_STOPPED, PROC_DONE } proc_state;
+
+/* One process of a job. */
+typedef struct {
+	pid_t pid;
+	proc_state state;
+	/* Whether it is in the job's process group. */
+	bool grouped;
+	/* Command name for reports, NULL if there is none. */
+	char *name;
+	/* Wait status and used CPU time once it is done. */
+	int status;
+	uint64_t cpu_ns;
+} job_proc;
+
+typedef struct job_tag {
+	/* Number shown to the user, 0 until the job is remembered. */
+	int id;
+	/* Process group, 0 without job control. */
+	pid_t pgid;
+	job_proc *procs;
+	size_t num_procs;
+	size_t cap;
+	/* Process whose status is the job's one, -1 if there is none. */
+	pid_t last;
+	/* Wait status of 'last'. */
+	int status;
+	/* Status of the last stopped process. */
+	int stop_status;
+	char *desc;
+	/* Run time limit in nanoseconds, 0 for none. */
+	uint64_t deadline;
+	int deadline_sig;
+	/* Delay of SIGKILL after 'deadline_sig', 0 for none. */
+	uint64_t kill_after;
+	/* Armed while a deadline runs, -1 otherwise. */
+	int timer_fd;
+	bool timed_out;
+	/* Resource limits set in each of its processes. */
+	Limits limits;
+	/* Processes from this index on are batches of one command, the first
+	 * failure among them is the job's status.
+	 * */
+	size_t batches_from;
+	/* SIGINT arrived while it ran in the foreground. */
+	bool interrupted;
+	/* Job being started when this one began, e.g. a call of a function
+	 * whose body runs this one.
+	 * */
+	struct job_tag *outer;
+} job;
+
+static struct {
+	bool enabled;
+	pid_t shell_pgid;
+	/* Terminal modes of the shell, restored after a job stops. */
+	struct termios tmodes;
+	/* Foreground job being started, NULL if there is none. Jobs of
+	 * a function's body are started while its call's job is.
+	 * */
+	job *building;
+	/* Remembered stopped and background jobs. */
+	job **table;
+	size_t count;
+	size_t cap;
+	/* Id of the job used by 'fg' and 'bg' without arguments. */
+	int current;
+	/* The shell exits once an interrupted foreground job ends. */
+	bool exit_on_interrupt;
+} jobs;
+
+/* Returns mask of the signals which stop the shell's processes. */
+static sigset_t
+stop_signals() {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTSTP);
+	sigaddset(&mask, SIGTTIN);
+	sigaddset(&mask, SIGTTOU);
+	return mask;
+}
+
+void
+jobs_init() {
+	if (!isatty(STDIN_FILENO))
+		return;
+	/* Started in the background, wait until we are brought to foreground. */
+	pid_t pgid;
+	while (tcgetpgrp(STDIN_FILENO) != (pgid = getpgrp()))
+		kill(-pgid, SIGTTIN);
+	/* The shell itself is never stopped, blocked SIGTTOU also allows it to
+	 * take the terminal back from the background.
+	 * */
+	sigset_t mask = stop_signals();
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+		err(1, "Cannot block stop signals.(sigprocmask)");
+	/* Session leaders already lead their group. */
+	if (setpgid(0, 0) == -1 && errno != EPERM) {
+		warn("job control disabled (setpgid)");
+		return;
+	}
+	jobs.shell_pgid = getpgrp();
+	if (tcsetpgrp(STDIN_FILENO, jobs.shell_pgid) == -1 ||
+		tcgetattr(STDIN_FILENO, &jobs.tmodes) == -1) {
+		warn("job control disabled (tcsetpgrp)");
+		return;
+	}
+	jobs.enabled = true;
+}
+
+void
+job_begin() {
+	/* Without job control C-c reaches the shell also while no job runs,
+	 * e.g. between two jobs. Left pending it would interrupt the next
+	 * one, so it is dropped unless the shell exits on it.
+	 * */
+	if (!jobs.enabled && !jobs.building &&
+		(sig_poll() & SIG_INTERRUPT) && jobs.exit_on_interrupt)
+		exit(128 + SIGINT);
+	job *j = calloc(1, sizeof *j);
+	if (!j)
+		err(1, "malloc");
+	j->last = -1;
+	j->timer_fd = -1;
+	j->batches_from = SIZE_MAX;
+	j->outer = jobs.building;
+	jobs.building = j;
+}
+
+void
+job_deadline(uint64_t ns, int sig, uint64_t kill_after) {
+	job *j = jobs.building;
+	assert(j);
+	assert(ns > 0);
+
+	if (j->deadline != 0 && j->deadline <= ns)
+		return;
+	j->deadline = ns;
+	j->deadline_sig = sig;
+	j->kill_after = kill_after;
+}
+
+void
+job_limits(const Limits *lims) {
+	assert(jobs.building);
+	assert(lims);
+
+	limits_merge(&jobs.building->limits, lims);
+}
+
+/* Whether the processes of the job get their own process group. Jobs with
+ * a deadline get it even without job control, so that the whole job is
+ * signalled once it expires.
+ * */
+static bool
+job_grouped(const job *j) {
+	return jobs.enabled || j->deadline != 0;
+}
+
+void
+job_forked(pid_t pid, const char *name) {
+	job *j = jobs.building;
+	assert(j);
+
+	if (j->num_procs == j->cap) {
+		j->cap = j->cap ? j->cap * 2 : 4;
+		if (!(j->procs = realloc(j->procs, j->cap * sizeof *j->procs)))
+			err(1, "malloc");
+	}
+	bool grouped = job_grouped(j);
+	char *name_copy = NULL;
+	if (name && !(name_copy = strdup(name)))
+		err(1, "malloc");
+	j->procs[j->num_procs++] =
+		(job_proc){pid, PROC_RUNNING, grouped, name_copy, 0, 0};
+	if (grouped) {
+		if (j->pgid == 0)
+			j->pgid = pid;
+		/* Also done by the child, whichever comes first. Fails once the
+		 * child has exec'd, then it is already in the group.
+		 * */
+		setpgid(pid, j->pgid);
+	}
+}
+
+void
+job_child() {
+	job *j = jobs.building;
+	if (j && job_grouped(j))
+		setpgid(0, j->pgid);
+	if (jobs.enabled && j) {
+		/* The first process takes the terminal, so that the job never
+		 * reads it before the shell hands it over.
+		 * */
+		if (j->pgid == 0)
+			tcsetpgrp(STDIN_FILENO, getpid());
+		sigset_t mask = stop_signals();
+		sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	}
+	/* A command which cannot be limited must not run at all. */
+	if (j && !limits_apply(&j->limits))
+		exit(1);
+	jobs_forget();
+}
+
+void
+jobs_exit_on_interrupt() {
+	jobs.exit_on_interrupt = true;
+}
+
+void
+jobs_forget() {
+	jobs.enabled = false;
+	jobs.building = NULL;
+	/* The jobs are children of the shell, not of this process. */
+	jobs.count = 0;
+	jobs.current = 0;
+}
+
+static void
+job_free(job *j) {
+	if (j->timer_fd != -1)
+		close(j->timer_fd);
+	for (size_t i = 0; i < j->num_procs; ++i)
+		free(j->procs[i].name);
+	free(j->procs);
+	free(j->desc);
+	free(j);
+}
+
+/* Collects state changes of the job's processes without blocking. */
+static void
+job_poll(job *j, int options) {
+	for (size_t i = 0; i < j->num_procs; ++i) {
+		job_proc *p = &j->procs[i];
+		if (p->state == PROC_DONE)
+			continue;
+		int status;
+		struct rusage usage;
+		int flags = options | WNOHANG;
+		pid_t res;
+		while ((res = wait4(p->pid, &status, flags, &usage)) == -1 &&
+			   errno == EINTR)
+			;
+		if (res == 0)
+			continue;
+		if (res == -1) /* Reaped elsewhere. */
+			p->state = PROC_DONE;
+		else if (WIFSTOPPED(status)) {
+			p->state = PROC_STOPPED;
+			j->stop_status = status;
+		} else if (WIFCONTINUED(status))
+			p->state = PROC_RUNNING;
+		else {
+			p->state = PROC_DONE;
+			p->status = status;
+			p->cpu_ns = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+							1000000000ull +
+						(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) *
+							1000ull;
+			if (i >= j->batches_from ? j->status == 0 : p->pid == j->last)
+				j->status = status;
+		}
+	}
+}
+
+/* Returns whether some process of the job runs. */
+static bool
+job_running(const job *j) {
+	for (size_t i = 0; i < j->num_procs; ++i)
+		if (j->procs[i].state == PROC_RUNNING)
+			return true;
+	return false;
+}
+
+/* Returns whether all processes of the job exited. */
+static bool
+job_done(const job *j) {
+	for (size_t i = 0; i < j->num_procs; ++i)
+		if (j->procs[i].state != PROC_DONE)
+			return false;
+	return true;
+}
+
+/* Sends 'sig' to all processes of the job. Processes which have not been
+ * reaped keep their PIDs, so they cannot be mistaken for others.
+ * */
+static void
+job_signal(const job *j, int sig) {
+	if (j->pgid != 0 && killpg(j->pgid, sig) == -1 && errno != ESRCH &&
+		errno != EPERM)
+		err(1, "killpg");
+	/* E.g. process substitutions started before the group existed. */
+	for (size_t i = 0; i < j->num_procs; ++i)
+		if (!j->procs[i].grouped && j->procs[i].state != PROC_DONE)
+			kill(j->procs[i].pid, sig);
+}
+
+/* Arms the job's timer to expire after 'ns' nanoseconds. */
+static void
+job_arm_timer(job *j, uint64_t ns) {
+	if (j->timer_fd == -1 &&
+		(j->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) == -1)
+		err(1, "Cannot enforce the deadline.(timerfd_create)");
+	struct itimerspec spec = {{0, 0}, {ns / 1000000000, ns % 1000000000}};
+	if (timerfd_settime(j->timer_fd, 0, &spec, NULL) == -1)
+		err(1, "Cannot enforce the deadline.(timerfd_settime)");
+}
+
+/* Handles expiration of the job's timer, the deadline signal is followed by
+ * SIGKILL.
+ * */
+static void
+job_expired(job *j) {
+	uint64_t expirations;
+	if (read(j->timer_fd, &expirations, sizeof expirations) == -1)
+		return;
+	if (!j->timed_out) {
+		j->timed_out = true;
+		job_signal(j, j->deadline_sig);
+		/* Stopped processes would not see it. */
+		job_signal(j, SIGCONT);
+		if (j->kill_after != 0) {
+			job_arm_timer(j, j->kill_after);
+			return;
+		}
+	} else
+		job_signal(j, SIGKILL);
+	close(j->timer_fd);
+	j->timer_fd = -1;
+}
+
+/* Waits for the next signal, handles expiration of the deadline meanwhile.
+ * Returns the mask of received signals.
+ * */
+static int
+job_wait_signal(job *j) {
+	if (j->timer_fd == -1)
+		return sig_read();
+	struct pollfd fds[2] = {{sig_fd(), POLLIN, 0}, {j->timer_fd, POLLIN, 0}};
+	if (poll(fds, 2, -1) == -1) {
+		if (errno != EINTR)
+			err(1, "poll");
+		return 0;
+	}
+	if (fds[1].revents)
+		job_expired(j);
+	return fds[0].revents ? sig_read() : 0;
+}
+
+void
+job_batches() {
+	assert(jobs.building);
+
+	jobs.building->batches_from = jobs.building->num_procs;
+}
+
+/* Returns the number of the job's running processes. */
+static size_t
+job_num_running(const job *j) {
+	size_t count = 0;
+	for (size_t i = 0; i < j->num_procs; ++i)
+		if (j->procs[i].state == PROC_RUNNING)
+			++count;
+	return count;
+}
+
+/* Whether the job was stopped, interrupted or timed out, or some of its
+ * batches was killed, so that no more should be started.
+ * */
+static bool
+job_halted(const job *j) {
+	if (j->interrupted || j->timed_out)
+		return true;
+	for (size_t i = 0; i < j->num_procs; ++i) {
+		const job_proc *p = &j->procs[i];
+		if (p->state == PROC_STOPPED ||
+			(i >= j->batches_from && p->state == PROC_DONE &&
+			 WIFSIGNALED(p->status)))
+			return true;
+	}
+	return false;
+}
+
+bool
+job_throttle(size_t max_running) {
+	job *j = jobs.building;
+	assert(j);
+	assert(max_running > 0);
+
+	int options = jobs.enabled ? WUNTRACED : 0;
+	if (j->deadline != 0 && !j->timed_out && j->timer_fd == -1)
+		job_arm_timer(j, j->deadline);
+	job_poll(j, options);
+	while (job_num_running(j) >= max_running && !job_halted(j)) {
+		if (job_wait_signal(j) & SIG_INTERRUPT) {
+			job_signal(j, SIGINT);
+			j->interrupted = true;
+		}
+		job_poll(j, options);
+	}
+	return !job_halted(j);
+}
+
+/* Reports processes of the finished job killed by its resource limits into
+ * 'fd'.
+ * */
+static void
+job_report_limits(int fd, const job *j) {
+	for (size_t i = 0; i < j->num_procs; ++i) {
+		const job_proc *p = &j->procs[i];
+		if (p->state != PROC_DONE || !WIFSIGNALED(p->status))
+			continue;
+		char buf[128];
+		const char *why =
+			limits_explain(&j->limits, WTERMSIG(p->status), p->cpu_ns, buf,
+						   sizeof buf);
+		if (why)
+			dprintf(fd, "%s: %s.\n", p->name ? p->name : j->desc, why);
+	}
+}
+
+/* Prints one job with its 'state' into 'fd'. */
+static void
+job_print(int fd, const job *j, const char *state) {
+	dprintf(fd, "[%d]%c  %-24s%s\n", j->id, j->id == jobs.current ? '+' : ' ',
+			state, j->desc);
+}
+
+/* Remembers the job in the table, it becomes the current one. */
+static void
+job_remember(job *j) {
+	if (j->id == 0) {
+		if (jobs.count == jobs.cap) {
+			jobs.cap = jobs.cap ? jobs.cap * 2 : 8;
+			if (!(jobs.table =
+					  realloc(jobs.table, jobs.cap * sizeof *jobs.table)))
+				err(1, "malloc");
+		}
+		j->id = jobs.count ? jobs.table[jobs.count - 1]->id + 1 : 1;
+		jobs.table[jobs.count++] = j;
+	}
+	jobs.current = j->id;
+}
+
+/* Removes the job from the table and frees it. */
+static void
+job_forget(job *j) {
+	for (size_t i = 0; i < jobs.count; ++i)
+		if (jobs.table[i] == j) {
+			memmove(jobs.table + i, jobs.table + i + 1,
+					(jobs.count - i - 1) * sizeof *jobs.table);
+			--jobs.count;
+			break;
+		}
+	if (j->id == jobs.current)
+		jobs.current = jobs.count ? jobs.table[jobs.count - 1]->id : 0;
+	job_free(j);
+}
+
+/* Waits in the foreground until the job exits or stops. A stopped job is
+ * remembered, a finished one is freed. Returns its status like
+ * job_run_fg().
+ * */
+static int
+job_wait_fg(job *j) {
+	if (jobs.enabled && j->pgid != 0 &&
+		tcsetpgrp(STDIN_FILENO, j->pgid) == -1 && errno != EPERM)
+		warn("tcsetpgrp");
+	int options = jobs.enabled ? WUNTRACED : 0;
+	/* Unless it already runs since job_throttle(). */
+	if (j->deadline != 0 && !j->timed_out && j->timer_fd == -1)
+		job_arm_timer(j, j->deadline);
+	bool interrupted = j->interrupted;
+	/* Processes may have ended while a nested job waited, e.g. one of
+	 * a function's body, and their SIGCHLD is gone.
+	 * */
+	job_poll(j, options);
+	while (job_running(j)) {
+		/* Only without job control, otherwise the terminal sends C-c just
+		 * to the job's group.
+		 * */
+		if (job_wait_signal(j) & SIG_INTERRUPT) {
+			job_signal(j, SIGINT);
+			interrupted = true;
+		}
+		job_poll(j, options);
+	}
+	/* The deadline only applies to the first run in foreground. */
+	j->deadline = 0;
+	if (j->timer_fd != -1) {
+		close(j->timer_fd);
+		j->timer_fd = -1;
+	}
+	if (jobs.enabled && j->pgid != 0) {
+		if (tcsetpgrp(STDIN_FILENO, jobs.shell_pgid) == -1)
+			warn("tcsetpgrp");
+		if (!job_done(j))
+			tcsetattr(STDIN_FILENO, TCSADRAIN, &jobs.tmodes);
+	}
+	int status = !job_done(j) ? j->stop_status : j->last == -1 ? 0 : j->status;
+	/* Like timeout(1), unless the job had to be killed. */
+	if (job_done(j) && j->timed_out &&
+		!(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL)) {
+		dprintf(STDERR_FILENO, "Timed out.\n");
+		status = W_EXITCODE(124, 0);
+	}
+	if (job_done(j)) {
+		job_report_limits(STDERR_FILENO, j);
+		if (j->id != 0)
+			job_forget(j);
+		else
+			job_free(j);
+	} else {
+		job_remember(j);
+		dprintf(STDERR_FILENO, "\n");
+		job_print(STDERR_FILENO, j, "Stopped");
+	}
+	if (interrupted && jobs.exit_on_interrupt)
+		exit(128 + SIGINT);
+	return status;
+}
+
+int
+job_run_fg(pid_t last, const char *desc) {
+	job *j = jobs.building;
+	assert(j);
+
+	jobs.building = j->outer;
+	j->last = last;
+	if (j->num_procs == 0) {
+		job_free(j);
+		return 0;
+	}
+	if (!(j->desc = strdup(desc ? desc : "")))
+		err(1, "malloc");
+	return job_wait_fg(j);
+}
+
+int
+job_exval(int status) {
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	else if (WIFSTOPPED(status))
+		return 128 + WSTOPSIG(status);
+	else if (WIFSIGNALED(status)) {
+		int sig = WTERMSIG(status);
+		/* Producers whose reader is gone end like that, e.g. in '<(cmd)'. */
+		if (sig != SIGPIPE)
+			dprintf(STDERR_FILENO, "Killed by signal %d.\n", sig);
+		return 128 + sig;
+	}
+	return 0;
+}
+
+/* Returns the remembered job with 'id' or NULL. */
+static job *
+job_by_id(int id) {
+	for (size_t i = 0; i < jobs.count; ++i)
+		if (jobs.table[i]->id == id)
+			return jobs.table[i];
+	return NULL;
+}
+
+int
+jobs_find(const char *spec) {
+	if (!spec)
+		return jobs.current ? jobs.current : -1;
+	if (*spec == '%')
+		++spec;
+	char *end;
+	long id = strtol(spec, &end, 10);
+	if (*spec == '\0' || *end != '\0' || id <= 0 || !job_by_id(id))
+		return -1;
+	return id;
+}
+
+int
+job_continue(int id, bool foreground) {
+	job *j = job_by_id(id);
+	assert(j);
+
+	jobs.current = id;
+	if (foreground)
+		dprintf(STDOUT_FILENO, "%s\n", j->desc);
+	else
+		dprintf(STDOUT_FILENO, "[%d]+ %s &\n", j->id, j->desc);
+	for (size_t i = 0; i < j->num_procs; ++i)
+		if (j->procs[i].state == PROC_STOPPED)
+			j->procs[i].state = PROC_RUNNING;
+	if (foreground && jobs.enabled && j->pgid != 0)
+		/* Before SIGCONT, so that the job does not read from the terminal
+		 * it does not own yet.
+		 * */
+		tcsetpgrp(STDIN_FILENO, j->pgid);
+	job_signal(j, SIGCONT);
+	return foreground ? job_exval(job_wait_fg(j)) : 0;
+}
+
+bool
+jobs_reap() {
+	bool finished = false;
+	for (size_t i = 0; i < jobs.count; ++i) {
+		job_poll(jobs.table[i], WUNTRACED | WCONTINUED);
+		finished |= job_done(jobs.table[i]);
+	}
+	return finished;
+}
+
+/* Returns description of the finished job's result. */
+static const char *
+job_result(const job *j, char *buf, size_t len) {
+	if (j->last == -1 || (WIFEXITED(j->status) && WEXITSTATUS(j->status) == 0))
+		return "Done";
+	if (WIFEXITED(j->status))
+		snprintf(buf, len, "Exit %d", WEXITSTATUS(j->status));
+	else
+		snprintf(buf, len, "Killed by signal %d", WTERMSIG(j->status));
+	return buf;
+}
+
+void
+jobs_notify(int fd) {
+	for (size_t i = 0; i < jobs.count;) {
+		job *j = jobs.table[i];
+		if (job_done(j)) {
+			char buf[32];
+			job_print(fd, j, job_result(j, buf, sizeof buf));
+			job_report_limits(fd, j);
+			job_forget(j);
+		} else
+			++i;
+	}
+}
+
+void
+jobs_print(int fd) {
+	jobs_reap();
+	for (size_t i = 0; i < jobs.count; ++i) {
+		job *j = jobs.table[i];
+		if (!job_done(j))
+			job_print(fd, j, job_running(j) ? "Running" : "Stopped");
+	}
+	jobs_notify(fd);
+}
+
+size_t
+jobs_count() {
+	size_t count = 0;
+	for (size_t i = 0; i < jobs.count; ++i)
+		if (!job_done(jobs.table[i]))
+			++count;
+	return count;
+}
@@ -0,0 +1,141 @@
+#ifndef MYSHELL_JOBS_HEADER
+#define MYSHELL_JOBS_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rlimits.h"
+
+/* Jobs and the terminal job control.
+ *
+ * Processes forked for one command, including its process substitutions,
+ * form a job. With job control each job gets its own process group which
+ * owns the terminal while it runs in the foreground, so C-c and C-z reach
+ * exactly the job's processes and signals are sent to the whole group by one
+ * killpg(). A stopped job is remembered for the 'fg', 'bg' and 'jobs'
+ * builtins. Without job control (scripts, -c, input not a terminal) the
+ * processes stay in the shell's group.
+ * */
+
+/* Enables job control if the standard input is a terminal, the shell takes
+ * it over in its own process group. Meant for the interactive mode.
+ * */
+void
+jobs_init();
+
+/* Starts a new foreground job, processes forked until job_run_fg() belong
+ * to it. Jobs begun meanwhile, e.g. by a function's body, are nested, the
+ * outer one continues being started after their job_run_fg(). Without job
+ * control SIGINT which arrived since the last job is dropped, or makes the
+ * shell exit after jobs_exit_on_interrupt().
+ * */
+void
+job_begin();
+
+/* Limits the run time of the job being started to 'ns' nanoseconds, e.g.
+ * by the 'timeout' prefix. Then 'sig' is sent to the whole job, followed by
+ * SIGKILL after 'kill_after' nanoseconds unless it is 0. The earliest
+ * deadline wins. It applies until the job finishes or stops, a timed out
+ * job exits with 124 unless it had to be killed. Processes forked before
+ * the call stay out of the job's process group, they are signalled one by
+ * one.
+ * */
+void
+job_deadline(uint64_t ns, int sig, uint64_t kill_after);
+
+/* Sets resource 'lims' in each process of the job being started, e.g. by
+ * the "ulimit" prefix. Processes forked before the call keep the shell's
+ * limits. Processes killed by a limit are reported when the job finishes.
+ * */
+void
+job_limits(const Limits *lims);
+
+/* Registers child 'pid' forked by the shell for the job being started.
+ * 'name' of its command is used in reports, it may be NULL.
+ * */
+void
+job_forked(pid_t pid, const char *name);
+
+/* Marks processes forked for the job being started from now on as batches
+ * of one command. The job's status is the first failure among them, or
+ * success.
+ * */
+void
+job_batches();
+
+/* Waits until fewer than 'max_running' processes of the job being started
+ * run, e.g. before starting another batch. Returns false once the job was
+ * stopped, interrupted or timed out, or a batch was killed by a signal,
+ * then no more should be started.
+ * */
+bool
+job_throttle(size_t max_running);
+
+/* Called first in a child forked for the job being started, moves it into
+ * the job's process group and sets the job's limits. The child controls no
+ * jobs itself.
+ * */
+void
+job_child();
+
+/* Makes the shell exit with 130 once a foreground job which was interrupted
+ * by SIGINT ends, e.g. in a cancelled worker of the daemon. Without it the
+ * shell goes on with the next command.
+ * */
+void
+jobs_exit_on_interrupt();
+
+/* Called in other children of the shell, e.g. of command substitutions.
+ * They control no jobs and forget the shell's ones.
+ * */
+void
+jobs_forget();
+
+/* Hands the terminal to the job being started and waits until all its
+ * processes exit or until it is stopped. 'desc' describes the job in
+ * reports. Returns the wait status of process 'last', the stop status if
+ * the job was stopped, 0 if 'last' is -1.
+ * */
+int
+job_run_fg(pid_t last, const char *desc);
+
+/* Returns exit value of a process with wait 'status' and reports its death
+ * by a signal.
+ * */
+int
+job_exval(int status);
+
+/* Returns the id of the job given by "%N" or "N" 'spec', the current one
+ * if 'spec' is NULL. Returns -1 if there is no such job.
+ * */
+int
+jobs_find(const char *spec);
+
+/* Continues the stopped or background job 'id'. In foreground it is waited
+ * for like by job_run_fg() and its exit value is returned, otherwise 0.
+ * */
+int
+job_continue(int id, bool foreground);
+
+/* Collects state changes of the remembered jobs without blocking. Returns
+ * true if some job finished and should be reported by jobs_notify().
+ * */
+bool
+jobs_reap();
+
+/* Reports and forgets the finished jobs into 'fd'. */
+void
+jobs_notify(int fd);
+
+/* Prints all remembered jobs into 'fd', finished ones are forgotten. */
+void
+jobs_print(int fd);
+
+/* Returns the number of remembered jobs which have not finished, i.e. run
+ * in the background or are stopped.
+ * */
+size_t
+jobs_count();
+#endif /* ifndef MYSHELL_JOBS_HEADER */
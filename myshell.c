@@ -1,34 +1,50 @@
+#define _GNU_SOURCE /* environ */
 #include <assert.h>
+#include <dlfcn.h>
 #include <err.h>
 #include <fcntl.h>
-#include <signal.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <sys/wait.h>
 
 #include "cmdexecution.h"
 #include "cmdparsing.h"
+#include "daemon.h"
 #include "myshell.h"
 #include "run_script.h"
 #include "run_prompt.h"
 #include "signals.h"
+#include "vars.h"
 
+/* Shared object with the interactive mode, next to the executable. */
+#define INTERACTIVE_LIB "mysh-interactive.so"
+
+/* Loads the interactive mode and runs it. Readline comes with it, so -c,
+ * scripts and the daemon start without loading and relocating it.
+ * */
 static int
-run_cmd(const char *cmd_str) {
-	char *err_msg = NULL;
-	Cmds *cmds = parse_line(cmd_str, &err_msg);
-	if (!cmds) {
-		dprintf(STDERR_FILENO, "error: %s\n", err_msg);
-		free((char *)err_msg);
-		return 2;
-	} else {
-		int exval = 0;
-		exec_cmds(cmds, &exval);
-		cmd_free_cmds(cmds);
-		return exval;
-	}
+run_prompt_lazy() {
+	char path[PATH_MAX];
+	ssize_t len =
+		readlink("/proc/self/exe", path, sizeof path - sizeof INTERACTIVE_LIB);
+	if (len == -1 || (size_t)len == sizeof path - sizeof INTERACTIVE_LIB)
+		errx(1, "Cannot locate %s.", INTERACTIVE_LIB);
+	path[len] = '\0';
+	char *slash = strrchr(path, '/');
+	strcpy(slash ? slash + 1 : path, INTERACTIVE_LIB);
+	void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!lib)
+		errx(1, "Cannot load the interactive mode: %s", dlerror());
+	int (*run)();
+	/* POSIX way of converting the object pointer to a function one. */
+	*(void **)&run = dlsym(lib, "run_prompt");
+	if (!run)
+		errx(1, "Cannot load the interactive mode: %s", dlerror());
+	return run();
 }
 
 /*
@@ -43,36 +59,59 @@ usage(char *prog_name) {
 		   "\t\t- Executes CMD.\n"
 		   "\t%s FILE\n"
 		   "\t\t- Executes all commands in the FILE.\n"
+		   "\t%s -d SOCKET [-j N]\n"
+		   "\t\t- Serves commands sent to the SOCKET, N at once.\n"
 		   "\nOther cases will show this help message.\n",
-		   prog_name, prog_name, prog_name);
+		   prog_name, prog_name, prog_name, prog_name);
 	exit(0);
 }
 
-/* Parses program's arguments.
- * Returns string passed to the -c argument or NULL.
+/* Options of the program. */
+typedef struct {
+	/* Argument of -c or NULL. */
+	char *cmd;
+	/* Socket of the daemon given by -d or NULL. */
+	char *socket;
+	/* Concurrent requests of the daemon given by -j, 0 for the default. */
+	int max_workers;
+} options;
+
+/* Parses program's arguments into 'opts'.
  * Exits on syntax error.
  * */
-static char *
-parse_args(int argc, char *argv[]) {
+static void
+parse_args(int argc, char *argv[], options *opts) {
 	int opt;
-	while ((opt = getopt(argc, argv, "c:h")) != -1) {
+	while ((opt = getopt(argc, argv, "c:d:hj:")) != -1) {
 		switch (opt) {
 		case 'c':
-			return optarg;
+			opts->cmd = optarg;
+			return;
+		case 'd':
+			opts->socket = optarg;
+			break;
+		case 'j':
+			if ((opts->max_workers = atoi(optarg)) <= 0)
+				usage(argv[0]);
+			break;
 		default:
 			usage(argv[0]);
 		}
 	}
-	return NULL;
 }
 
 int
 run_myshell(int argc, char **argv) {
-	char *c_arg = parse_args(argc, argv);
-	if (c_arg != NULL) /* -c arg present */ {
-		return run_cmd(c_arg);
+	vars_init(environ);
+	sig_init();
+	options opts = {NULL, NULL, 0};
+	parse_args(argc, argv, &opts);
+	if (opts.cmd != NULL) /* -c arg present */ {
+		return run_string(opts.cmd);
+	} else if (opts.socket != NULL) {
+		return run_daemon(opts.socket, opts.max_workers);
 	} else if (argc == 2) {
 		return run_script(argv[1]);
 	}
-	return run_prompt();
+	return run_prompt_lazy();
 }
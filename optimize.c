@@ -0,0 +1,219 @@
+#include "optimize.h"
+
+#include <assert.h>
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "builtins.h"
+#include "funcs.h"
+#include "globbing.h"
+#include "vars.h"
+
+/* Whether 'word' stays itself after expansion. */
+static bool
+is_plain(const char *word) {
+	return !strpbrk(word, "$<>") && !glob_has_magic(word);
+}
+
+/* Whether 'cmds' define function 'name', also in bodies of functions. */
+static bool
+defines(const Cmds *cmds, const char *name) {
+	const PipeCmd *pipe;
+	STAILQ_FOREACH(pipe, cmds, tailq) {
+		if (pipe->func && (strcmp(pipe->func->name, name) == 0 ||
+						   defines(pipe->func->body, name)))
+			return true;
+	}
+	return false;
+}
+
+/* Whether 'name' is a function or an alias of the shell or of 'root'. */
+static bool
+is_func(const Cmds *root, const char *name) {
+	return funcs_find(name) || defines(root, name);
+}
+
+static bool
+has_input(const CmdIO *io) {
+	return io->in || io->here || io->here_end;
+}
+
+/* Whether 'cmd' is the external "cat" and its output is not redirected. */
+static bool
+is_cat(const CmdSimple *cmd, const Cmds *root) {
+	return strcmp(cmd->name, "cat") == 0 && !cmd->io.out &&
+		   !is_func(root, "cat");
+}
+
+/* Whether 'cmd' alone still runs in a child, i.e. it is neither a builtin
+ * nor a function and its name is not expanded or prefixed into one.
+ * */
+static bool
+runs_in_child(const CmdSimple *cmd, const Cmds *root) {
+	const char *name = cmd->name;
+	return is_plain(name) && !vars_is_assign(name) && !builtin_find(name) &&
+		   !is_func(root, name) && strcmp(name, "timeout") != 0 &&
+		   strcmp(name, "ulimit") != 0;
+}
+
+/* Drops plain "cat" stages which have stages on both sides. */
+static bool
+drop_cats(PipeCmd *pipe, const Cmds *root) {
+	bool changed = false;
+	CmdSimple *prev = STAILQ_FIRST(&pipe->cmds);
+	CmdSimple *cmd;
+	while ((cmd = STAILQ_NEXT(prev, tailq)) && STAILQ_NEXT(cmd, tailq)) {
+		if (is_cat(cmd, root) && STAILQ_EMPTY(&cmd->args) &&
+			!has_input(&cmd->io)) {
+			STAILQ_REMOVE(&pipe->cmds, cmd, CmdSimple_tag, tailq);
+			cmd_free_simple(cmd);
+			changed = true;
+		} else
+			prev = cmd;
+	}
+	return changed;
+}
+
+/* Whether 'path' is a regular file which can be read, so that "cat" would
+ * copy it just like the redirection.
+ * */
+static bool
+is_readable_file(const char *path) {
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+		   access(path, R_OK) == 0;
+}
+
+/* Turns "cat FILE | cmd" and "cat < FILE | cmd" into "cmd < FILE". Sets
+ * *uses_files if FILE was checked.
+ * */
+static bool
+fold_cat(PipeCmd *pipe, const Cmds *root, bool *uses_files) {
+	CmdSimple *cat = STAILQ_FIRST(&pipe->cmds);
+	CmdSimple *next = STAILQ_NEXT(cat, tailq);
+	if (!next || !is_cat(cat, root) || has_input(&next->io))
+		return false;
+	CmdArg *arg = STAILQ_FIRST(&cat->args);
+	/* Exactly one file, either as an argument or as the input. */
+	if (arg ? STAILQ_NEXT(arg, tailq) || has_input(&cat->io) ||
+				  !is_plain(arg->val) || arg->val[0] == '-'
+			: !has_input(&cat->io))
+		return false;
+	if (!STAILQ_NEXT(next, tailq) && !runs_in_child(next, root))
+		return false;
+	CmdIO *io = &cat->io;
+	const char *file = arg ? arg->val : io->in;
+	if (file) {
+		if (!is_plain(file) || !is_readable_file(file))
+			return false;
+		*uses_files = true;
+	}
+	if (arg) {
+		next->io.in = arg->val;
+		arg->val = NULL;
+	} else {
+		next->io.in = io->in;
+		next->io.here = io->here;
+		next->io.here_end = io->here_end;
+		io->in = io->here = io->here_end = NULL;
+	}
+	STAILQ_REMOVE_HEAD(&pipe->cmds, tailq);
+	cmd_free_simple(cat);
+	return true;
+}
+
+/* Rewrites 'cmds' except for bodies of functions. Returns whether anything
+ * changed, sets *uses_files like optimize_cmds().
+ * */
+static bool
+optimize(Cmds *cmds, bool *uses_files) {
+	bool changed = false;
+	PipeCmd *pipe;
+	STAILQ_FOREACH(pipe, cmds, tailq) {
+		if (pipe->func)
+			continue;
+		changed |= drop_cats(pipe, cmds);
+		changed |= fold_cat(pipe, cmds, uses_files);
+	}
+	return changed;
+}
+
+static void
+print_simple(FILE *out, const CmdSimple *cmd) {
+	fputs(cmd->name, out);
+	const CmdArg *arg;
+	STAILQ_FOREACH(arg, &cmd->args, tailq) { fprintf(out, " %s", arg->val); }
+	const CmdIO *io = &cmd->io;
+	if (io->in)
+		fprintf(out, " < %s", io->in);
+	else if (io->here_end)
+		fprintf(out, " << %s", io->here_end);
+	else if (io->here)
+		fprintf(out, " <<< %.*s", (int)strcspn(io->here, "\n"), io->here);
+	if (io->out)
+		fprintf(out, " %s %s", io->app ? ">>" : ">", io->out);
+}
+
+/* Prints 'cmds' in the shell's syntax on one line. */
+static void
+print_cmds(FILE *out, const Cmds *cmds) {
+	const PipeCmd *pipe;
+	STAILQ_FOREACH(pipe, cmds, tailq) {
+		if (pipe != STAILQ_FIRST(cmds))
+			fputs(pipe->cond == CMD_AND	 ? " && "
+				  : pipe->cond == CMD_OR ? " || "
+										 : "; ",
+				  out);
+		if (pipe->func) {
+			fprintf(out, "%s() { ", pipe->func->name);
+			print_cmds(out, pipe->func->body);
+			fputs("; }", out);
+			continue;
+		}
+		const CmdSimple *cmd;
+		STAILQ_FOREACH(cmd, &pipe->cmds, tailq) {
+			if (cmd != STAILQ_FIRST(&pipe->cmds))
+				fputs(" | ", out);
+			print_simple(out, cmd);
+		}
+	}
+}
+
+bool
+optimize_enabled() {
+	const char *mode = vars_get("MYSH_OPTIMIZE");
+	return mode && (strcmp(mode, "1") == 0 || strcmp(mode, "dump") == 0);
+}
+
+bool
+optimize_cmds(Cmds *cmds) {
+	assert(cmds);
+
+	bool uses_files = false;
+	if (!optimize_enabled())
+		return false;
+	if (strcmp(vars_get("MYSH_OPTIMIZE"), "dump") != 0) {
+		optimize(cmds, &uses_files);
+		return uses_files;
+	}
+	char *before = NULL;
+	size_t len;
+	FILE *buf = open_memstream(&before, &len);
+	if (!buf)
+		err(1, "open_memstream");
+	print_cmds(buf, cmds);
+	fclose(buf);
+	if (optimize(cmds, &uses_files)) {
+		fprintf(stderr, "- %s\n+ ", before);
+		print_cmds(stderr, cmds);
+		fputc('\n', stderr);
+	}
+	free(before);
+	return uses_files;
+}
@@ -0,0 +1,41 @@
+#ifndef MYSHELL_OPTIMIZE_HEADER
+#define MYSHELL_OPTIMIZE_HEADER
+
+#include <stdbool.h>
+
+#include "cmdhiearchy.h"
+
+/* Rewriting of parsed commands into cheaper equivalents, enabled by
+ * MYSH_OPTIMIZE=1.
+ *
+ * - "cat FILE | cmd" and "cat < FILE | cmd" become "cmd < FILE", one
+ *   process and one pipe fewer, if FILE is a readable regular file when
+ *   the line is parsed. The same with a here-document or here-string is
+ *   always rewritten.
+ * - "cat" without arguments and redirections in the middle of a pipeline
+ *   only copies its input to its output and is dropped.
+ *
+ * Only words without expansions are rewritten and never "cat" which is
+ * a function or an alias, or is defined by the commands themselves.
+ * Bodies of functions are left alone, they run when "cat" or the files
+ * may be different. A pipeline is not shortened into a single builtin or
+ * function, which would then run in the shell instead of a child.
+ * Redirections overridden by later ones are already dropped by the parser.
+ *
+ * MYSH_OPTIMIZE=dump also prints each rewritten line to stderr before and
+ * after, once per parse, so not again for lines taken from
+ * parse_line_cached().
+ * */
+
+/* Rewrites 'cmds'. Returns whether the result depends on files which may
+ * change, so it must not be reused for the same line later.
+ * */
+bool
+optimize_cmds(Cmds *cmds);
+
+/* Whether optimize_cmds() rewrites anything, i.e. MYSH_OPTIMIZE is 1 or
+ * dump.
+ * */
+bool
+optimize_enabled();
+#endif /* ifndef MYSHELL_OPTIMIZE_HEADER */
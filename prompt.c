@@ -0,0 +1,393 @@
+#define _GNU_SOURCE /* pipe2 */
+#include "prompt.h"
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#include "jobs.h"
+#include "stats.h"
+#include "vars.h"
+
+#define PROMPT_LEN 512
+#define PROMPT_DEFAULT_BUDGET_MS 20
+/* Cached values younger than this are used without recomputing them. */
+#define SEG_FRESH_NS (1000 * 1000 * 1000ull)
+#define SEG_VALUE_LEN 64
+#define SEG_CACHE_SIZE 32
+/* Commands running at least this long show their duration. */
+#define CMD_SHOW_DURATION_NS (1000 * 1000 * 1000ull)
+
+/* Value of an asynchronous segment computed for one directory. */
+typedef struct {
+	/* NULL for unused entry. */
+	char *dir;
+	char value[SEG_VALUE_LEN];
+	uint64_t time;
+} seg_cache_entry;
+
+/* Segment computed asynchronously in a separate process. */
+typedef struct {
+	/* Computes the segment value for 'dir' into 'buf'. Runs in a separate
+	 * process, so it can block. Empty value hides the segment. */
+	void (*compute)(const char *dir, char *buf, size_t len);
+	/* printf format for non-empty value. */
+	const char *format;
+	seg_cache_entry cache[SEG_CACHE_SIZE];
+	/* Pipe from the running computation, -1 if there is none. */
+	int fd;
+	/* Directory for which the computation runs. */
+	char *dir;
+	/* Value read so far from 'fd'. */
+	char buf[SEG_VALUE_LEN];
+	size_t len;
+} async_segment;
+
+/* Reads the first line of 'path' into 'buf'. Returns false on error. */
+static bool
+read_first_line(const char *path, char *buf, size_t len) {
+	FILE *file = fopen(path, "re");
+	if (!file)
+		return false;
+	bool ok = fgets(buf, len, file) != NULL;
+	fclose(file);
+	if (ok)
+		buf[strcspn(buf, "\n")] = '\0';
+	return ok;
+}
+
+/* Finds git repository containing 'dir' and writes its checked-out branch or
+ * abbreviated commit into 'buf'.
+ * */
+static void
+compute_vcs(const char *dir, char *buf, size_t len) {
+	char path[PATH_MAX];
+	char head[PATH_MAX];
+	if (snprintf(path, sizeof path, "%s", dir) >= (int)sizeof path)
+		return;
+	size_t dir_len = strlen(path);
+	while (dir_len > 0) {
+		snprintf(path + dir_len, sizeof path - dir_len, "/.git/HEAD");
+		bool found = read_first_line(path, head, sizeof head);
+		if (!found) {
+			/* Worktrees and submodules have .git file "gitdir: DIR". */
+			path[dir_len + 5] = '\0';
+			if (read_first_line(path, head, sizeof head) &&
+				strncmp(head, "gitdir: ", 8) == 0) {
+				char gitdir[PATH_MAX];
+				path[dir_len] = '\0';
+				int gitdir_len =
+					head[8] == '/'
+						? snprintf(gitdir, sizeof gitdir, "%s/HEAD", head + 8)
+						: snprintf(gitdir, sizeof gitdir, "%s/%s/HEAD", path,
+								   head + 8);
+				found = gitdir_len < (int)sizeof gitdir &&
+						read_first_line(gitdir, head, sizeof head);
+			}
+		}
+		if (found) {
+			const char *ref = "ref: refs/heads/";
+			if (strncmp(head, ref, strlen(ref)) == 0)
+				snprintf(buf, len, "%s", head + strlen(ref));
+			else /* Detached HEAD. */
+				snprintf(buf, len, "%.7s", head);
+			return;
+		}
+		/* Continue with the parent directory. */
+		path[dir_len] = '\0';
+		char *slash = strrchr(path, '/');
+		dir_len = slash ? (size_t)(slash - path) : 0;
+	}
+}
+
+static async_segment async_segments[] = {
+	{&compute_vcs, " (%s)", {{NULL, "", 0}}, -1, NULL, "", 0},
+};
+#define NUM_ASYNC_SEGMENTS (sizeof async_segments / sizeof *async_segments)
+
+/* Time when the last command started. */
+static uint64_t cmd_start = 0;
+/* Time when the last command ended, 0 if it was already measured. */
+static uint64_t cmd_end = 0;
+static uint64_t last_duration = 0;
+static int last_exval = 0;
+
+void
+prompt_cmd_start() {
+	cmd_start = stats_now();
+}
+
+void
+prompt_cmd_end(int exval) {
+	cmd_end = stats_now();
+	last_duration = cmd_end - cmd_start;
+	last_exval = exval;
+}
+
+/* Returns the time budget for the asynchronous segments in nanoseconds. */
+static uint64_t
+budget_ns() {
+	const char *val = vars_get("MYSH_PROMPT_BUDGET_MS");
+	char *end;
+	long budget_ms = val ? strtol(val, &end, 10) : PROMPT_DEFAULT_BUDGET_MS;
+	if (!val || *end != '\0' || budget_ms < 0)
+		budget_ms = PROMPT_DEFAULT_BUDGET_MS;
+	return budget_ms * 1000 * 1000ull;
+}
+
+/* Returns cache entry of the segment for 'dir' or NULL. */
+static seg_cache_entry *
+seg_cache_find(async_segment *seg, const char *dir) {
+	for (int i = 0; i < SEG_CACHE_SIZE; ++i)
+		if (seg->cache[i].dir && strcmp(seg->cache[i].dir, dir) == 0)
+			return &seg->cache[i];
+	return NULL;
+}
+
+/* Stores the value for 'dir' into the cache, replaces the oldest entry. */
+static void
+seg_cache_store(async_segment *seg, const char *dir, const char *value) {
+	seg_cache_entry *entry = seg_cache_find(seg, dir);
+	if (!entry) {
+		entry = &seg->cache[0];
+		for (int i = 1; i < SEG_CACHE_SIZE; ++i)
+			if (seg->cache[i].time < entry->time)
+				entry = &seg->cache[i];
+		free(entry->dir);
+		if (!(entry->dir = strdup(dir)))
+			err(1, "malloc");
+	}
+	snprintf(entry->value, SEG_VALUE_LEN, "%s", value);
+	entry->time = stats_now();
+}
+
+/* Starts computation of the segment for 'dir' in a detached process. */
+static void
+seg_launch(async_segment *seg, const char *dir) {
+	assert(seg->fd == -1);
+
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		warn("prompt: pipe");
+		return;
+	}
+	pid_t pid = fork();
+	if (pid == -1) {
+		warn("prompt: fork");
+		close(fds[0]);
+		close(fds[1]);
+		return;
+	} else if (pid == 0) {
+		/* Double fork so that the shell never has to wait for it. */
+		if (fork() == 0) {
+			setsid();
+			close(fds[0]);
+			char value[SEG_VALUE_LEN] = "";
+			seg->compute(dir, value, SEG_VALUE_LEN - 1);
+			/* The newline marks complete result. */
+			strcat(value, "\n");
+			if (write(fds[1], value, strlen(value)) == -1)
+				_exit(1);
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+		;
+	if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1)
+		err(1, "fcntl");
+	seg->fd = fds[0];
+	if (!(seg->dir = strdup(dir)))
+		err(1, "malloc");
+	seg->len = 0;
+}
+
+/* Reads available part of the running computation, stores the result into
+ * the cache once it is complete. Returns true if the computation finished.
+ * */
+static bool
+seg_read(async_segment *seg) {
+	assert(seg->fd != -1);
+
+	ssize_t num_read;
+	while ((num_read = read(seg->fd, seg->buf + seg->len,
+							SEG_VALUE_LEN - seg->len - 1)) > 0)
+		seg->len += num_read;
+	if (num_read == -1 && (errno == EAGAIN || errno == EINTR))
+		return false;
+
+	/* EOF, error or full buffer finish the computation. */
+	seg->buf[seg->len] = '\0';
+	char *nl = strchr(seg->buf, '\n');
+	if (nl) {
+		*nl = '\0';
+		seg_cache_store(seg, seg->dir, seg->buf);
+	}
+	close(seg->fd);
+	seg->fd = -1;
+	free(seg->dir);
+	seg->dir = NULL;
+	return true;
+}
+
+/* Writes the current directory segment into 'buf', "~" replaces HOME. */
+static int
+gen_dir(char *buf, int len, const char *curr_dir) {
+	const char *home = vars_get("HOME");
+	bool in_home = false;
+	if (home) /* Skip the path to home if we are in home subtree. */
+	{
+		int home_len = strlen(home);
+		/* Prefix matches. The home folder is not prefix of another or
+		 * home==curr_dir. */
+		if (strncmp(home, curr_dir, home_len) == 0 &&
+			(curr_dir[home_len] == '/' || curr_dir[home_len] == '\0')) {
+			curr_dir += home_len;
+			in_home = true;
+		}
+	}
+	return snprintf(buf, len, "%s%s", in_home ? "~" : "", curr_dir);
+}
+
+/* Writes the number of background and stopped jobs into 'buf' if there are
+ * any.
+ * */
+static int
+gen_jobs(char *buf, int len) {
+	size_t count = jobs_count();
+	if (count == 0)
+		return snprintf(buf, len, "%s", "");
+	return snprintf(buf, len, " [%zu job%s]", count, count == 1 ? "" : "s");
+}
+
+/* Writes exit value and duration of the last command into 'buf' if they are
+ * worth showing.
+ * */
+static int
+gen_last_cmd(char *buf, int len) {
+	bool show_exval = last_exval != 0;
+	bool show_duration = last_duration >= CMD_SHOW_DURATION_NS;
+	if (!show_exval && !show_duration)
+		return snprintf(buf, len, "%s", "");
+	char exval[16] = "";
+	if (show_exval)
+		snprintf(exval, sizeof exval, "%d", last_exval);
+	char dur[32] = "";
+	if (show_duration)
+		snprintf(dur, sizeof dur, "%.1fs", last_duration / 1e9);
+	return snprintf(buf, len, " [%s%s%s]", exval,
+					show_exval && show_duration ? " " : "", dur);
+}
+
+/* Writes the prompt into 'prompt' from the current state of the segments. */
+static void
+render(char *prompt, int len, const char *curr_dir) {
+	int pos = snprintf(prompt, len, "mysh:");
+	pos += gen_dir(prompt + pos, pos < len ? len - pos : 0, curr_dir);
+	for (size_t i = 0; i < NUM_ASYNC_SEGMENTS; ++i) {
+		async_segment *seg = &async_segments[i];
+		seg_cache_entry *entry = seg_cache_find(seg, curr_dir);
+		const char *value = entry ? entry->value : "...";
+		if (*value != '\0')
+			pos += snprintf(prompt + pos, pos < len ? len - pos : 0,
+							seg->format, value);
+	}
+	pos += gen_jobs(prompt + pos, pos < len ? len - pos : 0);
+	pos += gen_last_cmd(prompt + pos, pos < len ? len - pos : 0);
+	snprintf(prompt + pos, pos < len ? len - pos : 0, "$");
+}
+
+/* Starts computation of the segment for 'dir' unless its cached value is
+ * fresh at 'now' or a computation is already running.
+ * */
+static void
+seg_refresh(async_segment *seg, const char *dir, uint64_t now) {
+	seg_cache_entry *entry = seg_cache_find(seg, dir);
+	if (seg->fd == -1 && (!entry || now - entry->time >= SEG_FRESH_NS))
+		seg_launch(seg, dir);
+}
+
+static char prompt[PROMPT_LEN];
+
+const char *
+prompt_gen() {
+	uint64_t start = stats_now();
+	uint64_t deadline = start + budget_ns();
+	const char *curr_dir = vars_get("PWD");
+	if (!curr_dir)
+		curr_dir = "";
+
+	for (size_t i = 0; i < NUM_ASYNC_SEGMENTS; ++i) {
+		async_segment *seg = &async_segments[i];
+		if (seg->fd != -1)
+			seg_read(seg);
+		seg_refresh(seg, curr_dir, start);
+		/* Only wait for the current directory. */
+		while (seg->fd != -1 && strcmp(seg->dir, curr_dir) == 0) {
+			uint64_t now = stats_now();
+			if (now >= deadline)
+				break;
+			struct pollfd pfd = {seg->fd, POLLIN, 0};
+			int timeout_ms = (deadline - now + 999999) / 1000000;
+			if (poll(&pfd, 1, timeout_ms) == -1 && errno != EINTR)
+				err(1, "poll");
+			seg_read(seg);
+		}
+	}
+	render(prompt, PROMPT_LEN, curr_dir);
+
+	/* Time to prompt is measured from the end of the last command. */
+	stats_record("prompt", stats_now() - (cmd_end ? cmd_end : start));
+	cmd_end = 0;
+	return prompt;
+}
+
+int
+prompt_pending_fd() {
+	for (size_t i = 0; i < NUM_ASYNC_SEGMENTS; ++i)
+		if (async_segments[i].fd != -1)
+			return async_segments[i].fd;
+	return -1;
+}
+
+void
+prompt_refresh() {
+	const char *curr_dir = vars_get("PWD");
+	if (!curr_dir)
+		curr_dir = "";
+	uint64_t now = stats_now();
+	for (size_t i = 0; i < NUM_ASYNC_SEGMENTS; ++i)
+		seg_refresh(&async_segments[i], curr_dir, now);
+}
+
+const char *
+prompt_collect() {
+	const char *curr_dir = vars_get("PWD");
+	if (!curr_dir)
+		curr_dir = "";
+	char old[PROMPT_LEN];
+	strcpy(old, prompt);
+	for (size_t i = 0; i < NUM_ASYNC_SEGMENTS; ++i) {
+		async_segment *seg = &async_segments[i];
+		if (seg->fd == -1)
+			continue;
+		bool other_dir = strcmp(seg->dir, curr_dir) != 0;
+		/* A computation for another directory might have been blocking the
+		 * one for the current directory. */
+		if (seg_read(seg) && other_dir && !seg_cache_find(seg, curr_dir))
+			seg_launch(seg, curr_dir);
+	}
+	render(prompt, PROMPT_LEN, curr_dir);
+	return strcmp(old, prompt) != 0 ? prompt : NULL;
+}
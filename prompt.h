@@ -0,0 +1,47 @@
+#ifndef MYSHELL_PROMPT_HEADER
+#define MYSHELL_PROMPT_HEADER
+
+/* Prompt of the interactive mode built from segments.
+ *
+ * Cheap segments (current directory, number of background jobs, exit value
+ * and duration of the last command) are computed on each prompt. Expensive ones (VCS branch) are
+ * computed by a detached process and cached per directory. The prompt waits
+ * for them at most MYSH_PROMPT_BUDGET_MS milliseconds, a late segment is
+ * shown as a placeholder or its stale cached value until it arrives.
+ * Time to prompt is recorded into the "prompt" stats tracker.
+ * */
+
+/* Marks the start of execution of a command line. */
+void
+prompt_cmd_start();
+
+/* Marks the end of execution of a command line with its exit value. */
+void
+prompt_cmd_end(int exval);
+
+/* Returns the prompt to show, the string is valid until the next call.
+ * Might block for up to the time budget.
+ * */
+const char *
+prompt_gen();
+
+/* Returns descriptor which becomes readable when a late segment arrives or
+ * -1 if all segments are complete.
+ * */
+int
+prompt_pending_fd();
+
+/* Recomputes stale segments of the shown prompt without waiting for them,
+ * e.g. while the user is idle. Their new values are collected by
+ * prompt_collect() once prompt_pending_fd() is readable.
+ * */
+void
+prompt_refresh();
+
+/* Collects the late segments which have arrived.
+ * Returns the new prompt if it has changed and should be redrawn, NULL
+ * otherwise. The string is valid until the next call to prompt_ functions.
+ * */
+const char *
+prompt_collect();
+#endif /* ifndef MYSHELL_PROMPT_HEADER */
@@ -0,0 +1,246 @@
+#include "rlimits.h"
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* CPU time the kernel may account short of the limit when it kills. */
+#define CPU_SLACK_NS (10 * 1000 * 1000ull)
+
+/* Supported limits with ulimit's option letters and units. */
+static const struct {
+	char opt;
+	int resource;
+	/* Bytes per unit of the value, 1 for counts and seconds. */
+	rlim_t unit;
+	const char *name;
+	/* NULL for counts. */
+	const char *unit_name;
+} kinds[LIMITS_COUNT] = {
+	{'c', RLIMIT_CORE, 1024, "core file size", "kB"},
+	{'d', RLIMIT_DATA, 1024, "data segment size", "kB"},
+	{'f', RLIMIT_FSIZE, 1024, "file size", "kB"},
+	{'n', RLIMIT_NOFILE, 1, "open files", NULL},
+	{'s', RLIMIT_STACK, 1024, "stack size", "kB"},
+	{'t', RLIMIT_CPU, 1, "CPU time", "s"},
+	{'u', RLIMIT_NPROC, 1, "processes", NULL},
+	{'v', RLIMIT_AS, 1024, "virtual memory", "kB"},
+};
+
+/* Returns index of the limit with option letter 'opt' or -1. */
+static int
+kind_find(char opt) {
+	for (int i = 0; i < LIMITS_COUNT; ++i)
+		if (kinds[i].opt == opt)
+			return i;
+	return -1;
+}
+
+/* Parses "unlimited" or a number of the limit's units. */
+static bool
+parse_value(int kind, const char *str, rlim_t *value) {
+	if (strcmp(str, "unlimited") == 0) {
+		*value = RLIM_INFINITY;
+		return true;
+	}
+	char *end;
+	errno = 0;
+	unsigned long long num = strtoull(str, &end, 10);
+	if (*str < '0' || *str > '9' || *end != '\0' || errno == ERANGE ||
+		num > (RLIM_INFINITY - 1) / kinds[kind].unit)
+		return false;
+	*value = num * kinds[kind].unit;
+	return true;
+}
+
+/* Formats the limit's 'value' in its units without the unit's name. */
+static const char *
+format_value(int kind, rlim_t value, char *buf, size_t len) {
+	if (value == RLIM_INFINITY)
+		return "unlimited";
+	snprintf(buf, len, "%llu", (unsigned long long)(value / kinds[kind].unit));
+	return buf;
+}
+
+int
+limits_parse(char *const *args, Limits *lims, bool report) {
+	assert(args);
+	assert(lims);
+
+	int which = LIMIT_SOFT | LIMIT_HARD;
+	int i = 0;
+	for (; args[i] && args[i][0] == '-'; ++i) {
+		const char *opt = args[i];
+		if (strcmp(opt, "--") == 0)
+			return i + 1;
+		if (strcmp(opt, "-S") == 0 || strcmp(opt, "-H") == 0) {
+			which = opt[1] == 'S' ? LIMIT_SOFT : LIMIT_HARD;
+			continue;
+		}
+		int kind = opt[1] != '\0' && opt[2] == '\0' ? kind_find(opt[1]) : -1;
+		if (kind == -1) {
+			if (report)
+				warnx("ulimit: invalid option \"%s\".", opt);
+			return -1;
+		}
+		rlim_t value;
+		if (!args[i + 1] || !parse_value(kind, args[i + 1], &value)) {
+			if (report)
+				warnx("ulimit: %s: invalid value \"%s\".", opt,
+					  args[i + 1] ? args[i + 1] : "");
+			return -1;
+		}
+		lims->which[kind] |= which;
+		if (which & LIMIT_SOFT)
+			lims->soft[kind] = value;
+		if (which & LIMIT_HARD)
+			lims->hard[kind] = value;
+		++i;
+	}
+	return i;
+}
+
+void
+limits_merge(Limits *into, const Limits *from) {
+	assert(into);
+	assert(from);
+
+	for (int i = 0; i < LIMITS_COUNT; ++i) {
+		into->which[i] |= from->which[i];
+		if (from->which[i] & LIMIT_SOFT)
+			into->soft[i] = from->soft[i];
+		if (from->which[i] & LIMIT_HARD)
+			into->hard[i] = from->hard[i];
+	}
+}
+
+bool
+limits_apply(const Limits *lims) {
+	assert(lims);
+
+	for (int i = 0; i < LIMITS_COUNT; ++i) {
+		if (!lims->which[i])
+			continue;
+		struct rlimit lim;
+		if (getrlimit(kinds[i].resource, &lim) == -1) {
+			warn("ulimit: %s", kinds[i].name);
+			return false;
+		}
+		if (lims->which[i] & LIMIT_SOFT)
+			lim.rlim_cur = lims->soft[i];
+		if (lims->which[i] & LIMIT_HARD) {
+			lim.rlim_max = lims->hard[i];
+			/* Lowering just the hard limit lowers the soft one too. */
+			if (!(lims->which[i] & LIMIT_SOFT) && lim.rlim_cur > lim.rlim_max)
+				lim.rlim_cur = lim.rlim_max;
+		}
+		if (setrlimit(kinds[i].resource, &lim) == -1) {
+			warn("ulimit: %s", kinds[i].name);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool
+limits_print(int fd, char opt, bool hard) {
+	int kind = kind_find(opt);
+	if (kind == -1 && opt != 'a')
+		return false;
+	for (int i = 0; i < LIMITS_COUNT; ++i) {
+		if (kind != -1 && i != kind)
+			continue;
+		struct rlimit lim;
+		if (getrlimit(kinds[i].resource, &lim) == -1)
+			err(1, "getrlimit");
+		char buf[32];
+		const char *value =
+			format_value(i, hard ? lim.rlim_max : lim.rlim_cur, buf, sizeof buf);
+		if (kind != -1)
+			dprintf(fd, "%s\n", value);
+		else if (kinds[i].unit_name)
+			dprintf(fd, "%-20s(%s, -%c) %s\n", kinds[i].name, kinds[i].unit_name,
+					kinds[i].opt, value);
+		else
+			dprintf(fd, "%-20s(-%c) %s\n", kinds[i].name, kinds[i].opt, value);
+	}
+	return true;
+}
+
+/* Returns the value of the limit in effect for a job with 'lims'. */
+static rlim_t
+effective(const Limits *lims, int kind, int which) {
+	if (lims->which[kind] & which)
+		return which == LIMIT_SOFT ? lims->soft[kind] : lims->hard[kind];
+	struct rlimit lim;
+	if (getrlimit(kinds[kind].resource, &lim) == -1)
+		return RLIM_INFINITY;
+	return which == LIMIT_SOFT ? lim.rlim_cur : lim.rlim_max;
+}
+
+/* Formats "the <name> limit of <value> <unit> (ulimit -X)" into 'buf'. */
+static const char *
+describe(int kind, int which, rlim_t value, char *buf, size_t len) {
+	char num[32];
+	snprintf(buf, len, "%s limit of %s%s%s exceeded (ulimit %s-%c)",
+			 kinds[kind].name, format_value(kind, value, num, sizeof num),
+			 kinds[kind].unit_name ? " " : "",
+			 kinds[kind].unit_name ? kinds[kind].unit_name : "",
+			 which == LIMIT_HARD ? "-H " : "", kinds[kind].opt);
+	return buf;
+}
+
+const char *
+limits_explain(const Limits *lims, int sig, uint64_t cpu_ns, char *buf,
+			   size_t len) {
+	assert(lims);
+	assert(buf);
+
+	int cpu = kind_find('t');
+	rlim_t value;
+	switch (sig) {
+	case SIGXCPU:
+		return describe(cpu, LIMIT_SOFT, effective(lims, cpu, LIMIT_SOFT), buf,
+						len);
+	case SIGKILL:
+		/* The kernel kills at the hard limit, others kill for other reasons.
+		 * */
+		value = effective(lims, cpu, LIMIT_HARD);
+		/* Compared in seconds, 'value' in nanoseconds might overflow. */
+		if (value != RLIM_INFINITY &&
+			(cpu_ns + CPU_SLACK_NS) / 1000000000ull >= value)
+			return describe(cpu, LIMIT_HARD, value, buf, len);
+		return NULL;
+	case SIGXFSZ:
+		return describe(kind_find('f'), LIMIT_SOFT,
+						effective(lims, kind_find('f'), LIMIT_SOFT), buf, len);
+	case SIGSEGV:
+	case SIGBUS:
+	case SIGABRT:
+		/* Failed allocations end like crashes, so only limits set for the job
+		 * itself are suspected.
+		 * */
+		for (const char *opt = "vds"; *opt; ++opt) {
+			int kind = kind_find(*opt);
+			for (int which = LIMIT_SOFT; which <= LIMIT_HARD; ++which) {
+				rlim_t value = which == LIMIT_SOFT ? lims->soft[kind]
+												   : lims->hard[kind];
+				if (!(lims->which[kind] & which) || value == RLIM_INFINITY)
+					continue;
+				size_t used = snprintf(buf, len, "possibly ");
+				/* Truncated, the description overwrites the NUL. */
+				if (used >= len)
+					used = len > 0 ? len - 1 : 0;
+				describe(kind, which, value, buf + used, len - used);
+				return buf;
+			}
+		}
+		return NULL;
+	default:
+		return NULL;
+	}
+}
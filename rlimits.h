@@ -0,0 +1,67 @@
+#ifndef MYSHELL_RLIMITS_HEADER
+#define MYSHELL_RLIMITS_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+/* Resource limits of the executed commands.
+ *
+ * Limits are given by ulimit's options, e.g. "-t 10" for 10 CPU seconds or
+ * "-v 102400" for 100 MiB of address space. The 'ulimit' builtin sets the
+ * shell's own limits which all commands inherit. As a "ulimit -t 10 cmd"
+ * prefix they only limit the job of the command, they are set by
+ * setrlimit() in each of its children between fork() and exec().
+ * */
+
+/* Number of the supported limits. */
+#define LIMITS_COUNT 8
+
+/* Which values of a limit are set. */
+#define LIMIT_SOFT 1
+#define LIMIT_HARD 2
+
+/* Limits to set, indexed like the supported limits. */
+typedef struct {
+	/* LIMIT_SOFT and LIMIT_HARD bits of the set values, 0 if the limit is
+	 * kept.
+	 * */
+	int which[LIMITS_COUNT];
+	rlim_t soft[LIMITS_COUNT];
+	rlim_t hard[LIMITS_COUNT];
+} Limits;
+
+/* Parses "[-S] [-H] -X value..." options at the start of NULL-terminated
+ * 'args' into 'lims', later ones win. Values are set after -S only soft,
+ * after -H only hard, both by default. Parsing stops at "--" or at the first
+ * word not starting with '-'. Returns the number of parsed words or -1 for
+ * an invalid option or value, which is reported if 'report' is set.
+ * */
+int
+limits_parse(char *const *args, Limits *lims, bool report);
+
+/* Merges 'from' into 'into', limits set by 'from' win. */
+void
+limits_merge(Limits *into, const Limits *from);
+
+/* Sets the limits of the calling process. Returns false after reporting
+ * a limit which could not be set.
+ * */
+bool
+limits_apply(const Limits *lims);
+
+/* Prints the shell's limit given by option letter 'opt', all of them if
+ * 'opt' is 'a'. Returns false for an unknown 'opt'.
+ * */
+bool
+limits_print(int fd, char opt, bool hard);
+
+/* Describes which limit likely killed a process by signal 'sig' after
+ * using 'cpu_ns' nanoseconds of CPU time, 'lims' were set for its job in
+ * addition to the shell's ones. Returns NULL if it was none of them.
+ * */
+const char *
+limits_explain(const Limits *lims, int sig, uint64_t cpu_ns, char *buf,
+			   size_t len);
+#endif /* ifndef MYSHELL_RLIMITS_HEADER */
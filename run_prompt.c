@@ -4,109 +4,171 @@
 #include <errno.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#include <readline/history.h>
 #include <readline/readline.h>
 
 #include "cmdexecution.h"
 #include "cmdhiearchy.h"
 #include "cmdparsing.h"
+#include "complete.h"
+#include "eventloop.h"
+#include "globbing.h"
+#include "histsearch.h"
+#include "jobs.h"
+#include "history.h"
+#include "prompt.h"
 #include "signals.h"
+#include "stats.h"
 
-/* Writes new prompt based on PWD into the passed buffer.
- * Returns number of chars printed(excl. \0).
- * If return>=length, the output was truncated. But the output
- * is always null-terminated.
- * */
-static int
-gen_prompt(char *buffer, int length) {
-	const char *curr_dir = getenv("PWD");
-	if (!curr_dir)
-		curr_dir = "";
+/* Prompt segments are refreshed after this long without a keystroke. */
+#define IDLE_REFRESH_MS 5000
 
-	const char *home = getenv("HOME");
-	bool in_home = false;
-	if (home) /* Skip the path to home if we are in home subtree. */
-	{
-		int home_len = strlen(home);
-		/* Prefix matches. The home folder is not prefix of another or
-		 * home==curr_dir. */
-		if (strncmp(home, curr_dir, home_len) == 0 &&
-			(curr_dir[home_len] == '/' || curr_dir[home_len] == '\0')) {
-			curr_dir += home_len;
-			in_home = true;
-		}
-	}
-	int num_written =
-		snprintf(buffer, length, "mysh:%s%s$", in_home ? "~" : "", curr_dir);
-	if (num_written < 0)
-		err(1, "Could not generate prompt(snprintf).");
-	return num_written;
-}
+/* State of the line being read by read_line(). */
+static struct {
+	/* The line handler has been called, 'line' is the result. */
+	bool done;
+	char *line;
+	/* Time of the last keystroke. */
+	uint64_t last_key;
+} input;
 
 /* Signals whether the call to read_line() has been SIGINTed and
  * returned only the unfinished line which should be discarded.
  * */
 static bool read_line_interrupted = false;
 
+/* Called by readline with the accepted line, NULL on EOF. */
+static void
+line_handler(char *line) {
+	rl_callback_handler_remove();
+	input.line = line;
+	input.done = true;
+}
+
+static void
+on_input(void *ctx) {
+	(void)ctx;
+	input.last_key = stats_now();
+	rl_callback_read_char();
+}
+
+/* C-c discards the unfinished line, it is left visible as it was. */
+static void
+on_signal(void *ctx) {
+	(void)ctx;
+	/* Arrived together with the end of the line, leave it pending for the
+	 * command.
+	 * */
+	if (input.done)
+		return;
+	int got = sig_read();
+	/* Finished background jobs are reported right away. */
+	if ((got & SIG_CHILD) && jobs_reap()) {
+		rl_clear_visible_line();
+		fflush(rl_outstream);
+		jobs_notify(STDERR_FILENO);
+		/* The count of jobs in the prompt changed. */
+		const char *prompt = prompt_collect();
+		if (prompt)
+			rl_set_prompt(prompt);
+		rl_forced_update_display();
+	}
+	if (!(got & SIG_INTERRUPT))
+		return;
+	rl_free_line_state();
+	rl_callback_sigcleanup();
+	rl_replace_line("", 0);
+	rl_echo_signal_char(SIGINT);
+	rl_callback_handler_remove();
+	rl_crlf();
+	read_line_interrupted = true;
+	input.line = strdup("");
+	if (!input.line)
+		err(1, "malloc");
+	input.done = true;
+}
+
+/* Redraws the prompt when a late prompt segment arrives. */
+static void
+on_prompt_segment(void *ctx) {
+	(void)ctx;
+	const char *prompt = prompt_collect();
+	if (prompt && !input.done) {
+		rl_clear_visible_line();
+		rl_set_prompt(prompt);
+		rl_forced_update_display();
+	}
+}
+
+/* Refreshes the prompt segments while the user is idle. */
+static void
+on_idle_timer(void *ctx) {
+	(void)ctx;
+	if (stats_now() - input.last_key >= IDLE_REFRESH_MS * 1000000ull)
+		prompt_refresh();
+}
+
 /*
- * Reads one line from the stdin and returns it.
+ * Reads one line from the stdin and returns it, 'prompt' is shown before it.
  * Returns NULL on EOF.
  * If C-c has been pressed then still returns unfinished but valid line and sets
  * 'read_line_interrupted' to true. The variable is cleared in the beginning of
  * each call.
+ * The event loop runs until the line is complete, so prompt segments and
+ * signals are handled while waiting for the input.
  * */
 static char *
-read_line() {
-#define PROMPT_LEN 256
-	char prompt[PROMPT_LEN];
-	gen_prompt(prompt, PROMPT_LEN);
-#undef PROMPT_LEN
-	struct sigaction old_act;
+read_line(const char *prompt) {
 	read_line_interrupted = false;
-	block_SIGINT(&old_act);
-	char *line = readline(prompt);
-	set_SIGINT(&old_act);
-	return line;
+	input.done = false;
+	input.line = NULL;
+	rl_callback_handler_install(prompt, &line_handler);
+	while (!input.done) {
+		/* Its descriptor changes with each computation of a segment. */
+		int segment_fd = prompt_pending_fd();
+		if (segment_fd != -1)
+			ev_watch(segment_fd, false, &on_prompt_segment, NULL);
+		ev_run_once();
+	}
+	return input.line;
 }
 
-/*
- * Read one character from passed stream.
- * is used as rl_getc_function in the readline library.
- * Note:
- * 	This function together with read_line()'s SIGINT settings allows
- * 	SIGINT interruption of the input and immidietely ends the input line.
- * 	Default implementation is rl_getc which restarts interrupted read()
- *  operation. So C-c doesn't break out of readline() call => cannot offer new
- *  prompt.
- * */
-int
-get_char(FILE *input) {
-	unsigned char c;
-	int res = read(fileno(input), &c, 1);
-	if (res == 1)
-		return c;
-	else if (res == 0) /*EOF*/
-		return EOF;
-	else if (errno == EINTR) /* SIGINT*/
-	{
-		read_line_interrupted = true;
-		return '\n';
-	} else
-		err(1, "Failed to read an input character.");
+/* Reads a line of a here-document. C-c discards the command. */
+static char *
+read_continuation_line(void *ctx) {
+	(void)ctx;
+	char *line = read_line("> ");
+	if (line && read_line_interrupted) {
+		free(line);
+		return NULL;
+	}
+	return line;
 }
 
 int
 run_prompt() {
-	rl_getc_function = &get_char;
+	/* SIGINT is handled by on_signal(), readline need not touch signals. */
+	rl_catch_signals = 0;
+	jobs_init();
+	ev_watch(STDIN_FILENO, true, &on_input, NULL);
+	ev_watch(sig_fd(), false, &on_signal, NULL);
+	ev_timer(IDLE_REFRESH_MS, &on_idle_timer, NULL);
+	hist_init();
+	/* After hist_init(), which binds C-r to lazy loading search. */
+	hsearch_init();
+	complete_init();
 	int exval = 0;
 	char *line = NULL;
 	while (true) {
-		line = read_line();
+		hist_sync();
+		jobs_reap();
+		jobs_notify(STDERR_FILENO);
+		line = read_line(prompt_gen());
 		if (line == NULL)
 			break;
 		if (read_line_interrupted) {
@@ -114,17 +176,26 @@ run_prompt() {
 			continue;
 		}
 		if (strcmp(line, "") != 0)
-			add_history(line);
+			hist_add(line);
 		char *err_msg = NULL;
-		Cmds *cmds = parse_line(line, &err_msg);
+		Cmds *cmds = parse_line_cached(line, &err_msg);
 		free(line);
+		if (cmds &&
+			!parse_heredocs(cmds, &read_continuation_line, NULL, &err_msg)) {
+			parse_release(cmds);
+			cmds = NULL;
+		}
 		if (!cmds) {
 			dprintf(STDERR_FILENO, "error:1: %s\n", err_msg);
 			free(err_msg);
 			exval = 2;
 		} else {
+			prompt_cmd_start();
 			exec_cmds(cmds, &exval);
-			cmd_free_cmds(cmds);
+			prompt_cmd_end(exval);
+			parse_release(cmds);
+			/* Directories are listed again for the next line. */
+			glob_cache_clear();
 		}
 	}
 	if (line == NULL) /*CTRL+D was pressed->newline + exit.*/
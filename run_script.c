@@ -3,14 +3,36 @@
 #include <assert.h>
 #include <err.h>
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/stat.h>
+
 #include "cmdexecution.h"
 #include "cmdhiearchy.h"
 #include "cmdparsing.h"
+#include "globbing.h"
+#include "vars.h"
+
+/* Maximum number of scripts run at once, i.e. nesting of "source". */
+#define SOURCE_MAX_DEPTH 100
+
+/* Script being run, the outer ones run "source" on their current line. */
+typedef struct {
+	const char *file;
+	/* Line where the current command starts. */
+	const int *line_num;
+	/* Whether it is sourced, not the script given to the shell. */
+	bool sourced;
+} script_frame;
+
+static struct {
+	script_frame frames[SOURCE_MAX_DEPTH];
+	int depth;
+} scripts;
 
 /* Stores currently loaded chunk from  a script file. */
 typedef struct line_buffer_t {
@@ -109,36 +131,167 @@ read_one_line(int fd, line_buffer *buffer, char **line) {
 	return buffer->newline;
 }
 
-/* Executes commands loaded from a script file.
- * Returns exit value of the last executed command of an error.
- * Exits the proram if the file cannot be opened or read.
+/* Lines of a script read after the current one. */
+typedef struct {
+	int fd;
+	line_buffer *buffer;
+	int *line_num;
+} script_source;
+
+/* Returns copy of the next line of the script or NULL at its end. */
+static char *
+script_next_line(void *ctx) {
+	script_source *src = ctx;
+	char *line;
+	if (read_one_line(src->fd, src->buffer, &line) == -1)
+		return NULL;
+	++*src->line_num;
+	char *copy = strdup(line);
+	if (!copy)
+		err(1, "malloc");
+	return copy;
+}
+
+/* Returns copy of the next line of a commands string, NULL after the last one.
+ * 'ctx' points to the start of the line, NULL at the end.
  * */
+static char *
+next_arg_line(void *ctx) {
+	const char **pos = ctx;
+	if (!*pos)
+		return NULL;
+	const char *newline = strchr(*pos, '\n');
+	char *line = newline ? strndup(*pos, newline - *pos) : strdup(*pos);
+	if (!line)
+		err(1, "malloc");
+	*pos = newline ? newline + 1 : NULL;
+	return line;
+}
+
 int
-run_script(const char *file) {
-	assert(file);
+run_string(const char *cmd_str) {
+	assert(cmd_str);
 
-	int in_fd = open(file, O_RDONLY);
-	if (in_fd == -1)
-		err(1, "Can't open: %s", file);
+	int exval = 0;
+	const char *pos = cmd_str;
+	char *line;
+	while ((line = next_arg_line(&pos))) {
+		char *err_msg = NULL;
+		Cmds *cmds = parse_line_cached(line, &err_msg);
+		free(line);
+		if (cmds && !parse_heredocs(cmds, &next_arg_line, &pos, &err_msg)) {
+			parse_release(cmds);
+			cmds = NULL;
+		}
+		if (!cmds) {
+			dprintf(STDERR_FILENO, "error: %s\n", err_msg);
+			free((char *)err_msg);
+			return 2;
+		}
+		exec_cmds(cmds, &exval);
+		parse_release(cmds);
+		/* Directories are listed again for the next line. */
+		glob_cache_clear();
+	}
+	return exval;
+}
+
+/* Prints the syntax error with the current line of each script being run,
+ * the outermost first.
+ * */
+static void
+print_error(const char *err_msg) {
+	dprintf(STDERR_FILENO, "error:");
+	for (int i = 0; i < scripts.depth; ++i) {
+		const script_frame *frame = &scripts.frames[i];
+		if (frame->sourced)
+			dprintf(STDERR_FILENO, " %s:%d:", frame->file, *frame->line_num);
+		else
+			dprintf(STDERR_FILENO, "%d:", *frame->line_num);
+	}
+	dprintf(STDERR_FILENO, " %s\n", err_msg);
+}
+
+/* Executes commands read from 'in_fd' of script 'file'.
+ * Returns exit value of the last executed command or 2 after a syntax
+ * error, which stops the script.
+ * */
+static int
+run_fd(int in_fd, const char *file, bool sourced) {
 	line_buffer buff;
 	line_buffer_init(&buff);
 	char *line;
 	int line_num = 1;
 	int exval = 0;
+	int cmd_line = line_num;
+	script_source src = {in_fd, &buff, &line_num};
+	scripts.frames[scripts.depth++] = (script_frame){file, &cmd_line, sourced};
 	while (read_one_line(in_fd, &buff, &line) != -1) {
 		char *err_msg = NULL;
-		Cmds *cmds = parse_line(line, &err_msg);
+		cmd_line = line_num;
+		Cmds *cmds = parse_line_cached(line, &err_msg);
+		if (cmds && !parse_heredocs(cmds, &script_next_line, &src, &err_msg)) {
+			parse_release(cmds);
+			cmds = NULL;
+		}
 		if (!cmds) {
-			dprintf(STDERR_FILENO, "error:%d: %s\n", line_num, err_msg);
+			print_error(err_msg);
 			free((char *)err_msg);
 			exval = 2;
 			break;
 		} else {
 			exec_cmds(cmds, &exval);
-			cmd_free_cmds(cmds);
+			parse_release(cmds);
+			glob_cache_clear();
 		}
 		++line_num;
 	}
+	--scripts.depth;
 	free(buff.buffer);
 	return exval;
 }
+
+int
+run_script(const char *file) {
+	assert(file);
+
+	int in_fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (in_fd == -1)
+		err(1, "Can't open: %s", file);
+	int exval = run_fd(in_fd, file, false);
+	close(in_fd);
+	return exval;
+}
+
+int
+run_source(const char *file, char **args) {
+	assert(file);
+	assert(args);
+
+	if (scripts.depth >= SOURCE_MAX_DEPTH) {
+		warnx("%s: maximum source nesting exceeded.", file);
+		return 1;
+	}
+	int in_fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (in_fd == -1) {
+		warn("Can't open: %s", file);
+		return 1;
+	}
+	struct stat st;
+	/* Reading a directory would fail and exit the shell. */
+	if (fstat(in_fd, &st) == 0 && S_ISDIR(st.st_mode)) {
+		warnx("%s: is a directory.", file);
+		close(in_fd);
+		return 1;
+	}
+	size_t count = 0;
+	while (args[count])
+		++count;
+	if (count > 0)
+		vars_push_args(args, count);
+	int exval = run_fd(in_fd, file, true);
+	if (count > 0)
+		vars_pop_args();
+	close(in_fd);
+	return exval;
+}
@@ -9,4 +9,20 @@
 int
 run_script(const char *file);
 
+/* Executes commands in 'file' in the current shell for "source" and ".".
+ * NULL-terminated 'args', if any, are the positional parameters meanwhile.
+ * A syntax error stops just this file and is reported with the line in
+ * each script running it. At most 100 scripts run at once.
+ * Returns exit value of the last command executed, 1 if the file cannot be
+ * opened and 2 on a syntax error.
+ * */
+int
+run_source(const char *file, char **args);
+
+/* Executes commands in the passed string, e.g. of the -c argument.
+ * Returns exit value of the last command executed, 2 on a syntax error.
+ * */
+int
+run_string(const char *cmd_str);
+
 #endif /* ifndef MYSHELL_RUN_SCRIPT_HEADER */
@@ -2,27 +2,86 @@
 
 #include <assert.h>
 #include <err.h>
-#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
 
-static void
-empty_handler(int signum) {
-	(void)signum;
-}
+#include <sys/signalfd.h>
+
+/* Number of signals read at once. */
+#define SIG_BATCH 8
+
+static struct {
+	int fd;
+	/* Mask inherited from the parent, restored for the commands. */
+	sigset_t orig_mask;
+} sigs = {-1, {{0}}};
 
 void
-block_SIGINT(struct sigaction *old_act) {
-	struct sigaction act;
-	act.sa_handler = &empty_handler;
-	act.sa_flags = 0;
-	sigemptyset(&act.sa_mask);
-	if (sigaction(SIGINT, &act, old_act) == -1)
-		err(1, "Cannot block SIGINT(sigaction).");
+sig_init() {
+	assert(sigs.fd == -1);
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &mask, &sigs.orig_mask) == -1)
+		err(1, "Cannot block signals.(sigprocmask)");
+	if ((sigs.fd = signalfd(-1, &mask, SFD_CLOEXEC)) == -1)
+		err(1, "Cannot receive signals.(signalfd)");
+}
+
+int
+sig_fd() {
+	return sigs.fd;
 }
 
 void
-set_SIGINT(struct sigaction *act) {
-	assert(act);
+sig_move_fd(int min_fd) {
+	assert(sigs.fd != -1);
+
+	if (sigs.fd >= min_fd)
+		return;
+	int fd = fcntl(sigs.fd, F_DUPFD_CLOEXEC, min_fd);
+	if (fd == -1)
+		err(1, "Cannot move signalfd.(fcntl)");
+	close(sigs.fd);
+	sigs.fd = fd;
+}
+
+int
+sig_read() {
+	assert(sigs.fd != -1);
+
+	struct signalfd_siginfo infos[SIG_BATCH];
+	ssize_t res;
+	while ((res = read(sigs.fd, infos, sizeof infos)) == -1 && errno == EINTR)
+		;
+	if (res == -1)
+		err(1, "Cannot read signals.(read)");
+	int got = 0;
+	for (size_t i = 0; i < res / sizeof *infos; ++i)
+		if (infos[i].ssi_signo == SIGINT)
+			got |= SIG_INTERRUPT;
+		else if (infos[i].ssi_signo == SIGCHLD)
+			got |= SIG_CHILD;
+	return got;
+}
 
-	if (sigaction(SIGINT, act, NULL) == -1)
-		err(1, "Cannot restore SIGINT(sigaction).");
+int
+sig_poll() {
+	sigset_t pending;
+	if (sigpending(&pending) == -1)
+		err(1, "Cannot get pending signals.(sigpending)");
+	/* Blocked signals stay pending until the signalfd is read. */
+	if (!sigismember(&pending, SIGINT) && !sigismember(&pending, SIGCHLD))
+		return 0;
+	return sig_read();
+}
+
+void
+sig_restore() {
+	if (sigprocmask(SIG_SETMASK, &sigs.orig_mask, NULL) == -1)
+		err(1, "Cannot restore signal mask.(sigprocmask)");
 }
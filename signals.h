@@ -1,17 +1,47 @@
 #ifndef MYSHELL_SIGNALS_HEADER
 #define MYSHELL_SIGNALS_HEADER
 
-#include <signal.h>
+/* Signal handling of the shell.
+ *
+ * SIGINT and SIGCHLD are blocked once at startup and received through a
+ * signalfd, so they are handled synchronously together with other events,
+ * e.g. when waiting for children or for input. Nothing changes per command
+ * and no signal can slip between checking a flag and a blocking call.
+ * */
 
-/* Blocks SIGINT(enables EINTR) and sets 'old_act' to old signal handler.
- * Exits on error.
+/* Received signals, a bitmask. */
+#define SIG_INTERRUPT 1
+#define SIG_CHILD 2
+
+/* Blocks the signals and opens the signalfd. Exits on error. */
+void
+sig_init();
+
+/* Returns the signalfd, it is readable when a signal is pending. */
+int
+sig_fd();
+
+/* Moves the signalfd to a descriptor not lower than 'min_fd', e.g. out of
+ * the way of the standard ones which are to be replaced. Exits on error.
  * */
 void
-block_SIGINT(struct sigaction *old_act);
+sig_move_fd(int min_fd);
 
-/* Sets signal action as a signal handler for SIGINT.
+/* Returns the mask of pending signals, blocks until at least one arrives.
  * Exits on error.
  * */
+int
+sig_read();
+
+/* Returns the mask of pending signals like sig_read() but without blocking,
+ * 0 if there are none. Exits on error.
+ * */
+int
+sig_poll();
+
+/* Restores the signal mask the shell started with. Children call it before
+ * they exec.
+ * */
 void
-set_SIGINT(struct sigaction *act);
+sig_restore();
 #endif /* ifndef MYSHELL_SIGNALS_HEADER */
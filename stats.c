@@ -0,0 +1,101 @@
+#include "stats.h"
+
+#include <assert.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STATS_MAX_TRACKERS 16
+#define STATS_WINDOW 4096
+
+/* Samples of one tracker. */
+typedef struct {
+	const char *name;
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	/* Ring buffer of the last STATS_WINDOW samples. */
+	uint64_t *window;
+} stats_tracker;
+
+static stats_tracker trackers[STATS_MAX_TRACKERS];
+static int num_trackers = 0;
+
+uint64_t
+stats_now() {
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(1, "clock_gettime");
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* Returns the tracker called 'name', creates it if it does not exist.
+ * Returns NULL if there is no space for another one.
+ * */
+static stats_tracker *
+stats_find(const char *name) {
+	for (int i = 0; i < num_trackers; ++i)
+		if (strcmp(trackers[i].name, name) == 0)
+			return &trackers[i];
+	if (num_trackers == STATS_MAX_TRACKERS)
+		return NULL;
+	stats_tracker *t = &trackers[num_trackers++];
+	t->name = name;
+	t->window = malloc(STATS_WINDOW * sizeof *t->window);
+	if (!t->window)
+		err(1, "malloc");
+	return t;
+}
+
+void
+stats_record(const char *name, uint64_t nsec) {
+	assert(name);
+
+	stats_tracker *t = stats_find(name);
+	if (!t)
+		return;
+	t->window[t->count % STATS_WINDOW] = nsec;
+	++t->count;
+	t->total += nsec;
+	if (nsec > t->max)
+		t->max = nsec;
+}
+
+static int
+cmp_samples(const void *l, const void *r) {
+	uint64_t lhs = *(const uint64_t *)l;
+	uint64_t rhs = *(const uint64_t *)r;
+	return lhs < rhs ? -1 : lhs > rhs;
+}
+
+/* Returns p-th percentile of sorted 'samples'. */
+static double
+percentile_ms(const uint64_t *samples, int num, int p) {
+	int i = (num * p + 99) / 100 - 1;
+	return samples[i < 0 ? 0 : i] / 1e6;
+}
+
+void
+stats_print(int fd) {
+	uint64_t *sorted = malloc(STATS_WINDOW * sizeof *sorted);
+	if (!sorted)
+		err(1, "malloc");
+	for (int i = 0; i < num_trackers; ++i) {
+		stats_tracker *t = &trackers[i];
+		int num = t->count < STATS_WINDOW ? t->count : STATS_WINDOW;
+		if (num == 0)
+			continue;
+		memcpy(sorted, t->window, num * sizeof *sorted);
+		qsort(sorted, num, sizeof *sorted, &cmp_samples);
+		dprintf(fd,
+				"%s: n=%llu avg=%.3fms p50=%.3fms p90=%.3fms p99=%.3fms "
+				"max=%.3fms\n",
+				t->name, (unsigned long long)t->count,
+				t->total / 1e6 / t->count, percentile_ms(sorted, num, 50),
+				percentile_ms(sorted, num, 90), percentile_ms(sorted, num, 99),
+				t->max / 1e6);
+	}
+	free(sorted);
+}
@@ -0,0 +1,25 @@
+#ifndef MYSHELL_STATS_HEADER
+#define MYSHELL_STATS_HEADER
+
+#include <stdint.h>
+
+/* Latency statistics of the shell's internals, printed by 'stats' builtin.
+ * Each named tracker keeps a window of the most recent samples from which
+ * the percentiles are computed.
+ * */
+
+/* Returns current monotonic time in nanoseconds. */
+uint64_t
+stats_now();
+
+/* Records one sample of 'nsec' nanoseconds to the tracker called 'name'.
+ * The tracker is created on the first use, 'name' must stay valid for the
+ * whole run of the program (string literal).
+ * */
+void
+stats_record(const char *name, uint64_t nsec);
+
+/* Prints summary of all trackers into 'fd'. */
+void
+stats_print(int fd);
+#endif /* ifndef MYSHELL_STATS_HEADER */
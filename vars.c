@@ -0,0 +1,366 @@
+#include "vars.h"
+
+#include <assert.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VARS_INIT_BUCKETS 1024
+
+/* One variable. */
+typedef struct var_tag {
+	/* "NAME=value", exactly as it is passed in envp. */
+	char *entry;
+	size_t name_len;
+	bool exported;
+	struct var_tag *next;
+} var;
+
+/* Variable overridden by vars_push_temp(). */
+typedef struct {
+	char *name;
+	/* Previous entry, NULL if the variable was not set. */
+	char *entry;
+	bool exported;
+} saved_var;
+
+/* Positional parameters of one function call. */
+typedef struct args_frame_tag {
+	char **args;
+	size_t count;
+	struct args_frame_tag *outer;
+} args_frame;
+
+static struct {
+	/* Chained hash table of the variables. */
+	var **buckets;
+	size_t num_buckets;
+	size_t count;
+	/* Exported entries, NULL if they must be collected again. */
+	char **envp;
+	saved_var *saved;
+	size_t num_saved;
+	/* Where each vars_push_temp() starts in 'saved'. */
+	size_t *frames;
+	size_t num_frames;
+	/* Innermost call, NULL outside of functions. */
+	args_frame *args;
+} vars;
+
+/* FNV-1a hash of the name. */
+static uint64_t
+hash_name(const char *name, size_t len) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= (unsigned char)name[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/* Returns the link pointing to the variable, the link is NULL if the variable
+ * does not exist.
+ * */
+static var **
+var_find(const char *name, size_t len) {
+	if (vars.num_buckets == 0)
+		return NULL;
+	var **link = &vars.buckets[hash_name(name, len) & (vars.num_buckets - 1)];
+	while (*link && ((*link)->name_len != len ||
+					 memcmp((*link)->entry, name, len) != 0))
+		link = &(*link)->next;
+	return link;
+}
+
+/* Doubles the table. */
+static void
+vars_grow() {
+	size_t old_num = vars.num_buckets;
+	var **old = vars.buckets;
+	vars.num_buckets = old_num ? old_num * 2 : VARS_INIT_BUCKETS;
+	if (!(vars.buckets = calloc(vars.num_buckets, sizeof *vars.buckets)))
+		err(1, "malloc");
+	for (size_t i = 0; i < old_num; ++i)
+		while (old[i]) {
+			var *v = old[i];
+			old[i] = v->next;
+			var **bucket = &vars.buckets[hash_name(v->entry, v->name_len) &
+										 (vars.num_buckets - 1)];
+			v->next = *bucket;
+			*bucket = v;
+		}
+	free(old);
+}
+
+/* Forgets the envp, it is collected again when needed. */
+static void
+envp_invalidate() {
+	free(vars.envp);
+	vars.envp = NULL;
+}
+
+/* Sets the variable to "NAME=value" 'entry' which is claimed. */
+static var *
+var_put(char *entry, size_t name_len, bool export) {
+	if (vars.count + 1 > vars.num_buckets)
+		vars_grow();
+	var **link = var_find(entry, name_len);
+	var *v = *link;
+	if (v)
+		free(v->entry);
+	else {
+		if (!(v = malloc(sizeof *v)))
+			err(1, "malloc");
+		v->name_len = name_len;
+		v->exported = false;
+		v->next = NULL;
+		*link = v;
+		++vars.count;
+	}
+	v->entry = entry;
+	v->exported |= export;
+	if (v->exported)
+		envp_invalidate();
+	return v;
+}
+
+void
+vars_init(char **envp) {
+	assert(envp);
+
+	for (char **e = envp; *e; ++e) {
+		const char *eq = strchr(*e, '=');
+		if (!eq)
+			continue;
+		char *entry = strdup(*e);
+		if (!entry)
+			err(1, "malloc");
+		var_put(entry, eq - *e, true);
+	}
+}
+
+void
+vars_clear() {
+	for (size_t i = 0; i < vars.num_buckets; ++i)
+		while (vars.buckets[i]) {
+			var *v = vars.buckets[i];
+			vars.buckets[i] = v->next;
+			free(v->entry);
+			free(v);
+		}
+	vars.count = 0;
+	envp_invalidate();
+}
+
+const char *
+vars_get(const char *name) {
+	assert(name);
+
+	size_t len = strlen(name);
+	var **link = var_find(name, len);
+	return link && *link ? (*link)->entry + len + 1 : NULL;
+}
+
+bool
+vars_exported(const char *name) {
+	assert(name);
+
+	var **link = var_find(name, strlen(name));
+	return link && *link && (*link)->exported;
+}
+
+void
+vars_set(const char *name, const char *value, bool export) {
+	assert(name);
+	assert(value);
+
+	size_t name_len = strlen(name);
+	size_t len = name_len + strlen(value) + 2;
+	char *entry = malloc(len);
+	if (!entry)
+		err(1, "malloc");
+	snprintf(entry, len, "%s=%s", name, value);
+	var_put(entry, name_len, export);
+}
+
+void
+vars_assign(const char *assign, bool export) {
+	assert(vars_is_assign(assign));
+
+	char *entry = strdup(assign);
+	if (!entry)
+		err(1, "malloc");
+	var_put(entry, strchr(assign, '=') - assign, export);
+}
+
+void
+vars_export(const char *name) {
+	assert(name);
+
+	var **link = var_find(name, strlen(name));
+	if (link && *link) {
+		if (!(*link)->exported) {
+			(*link)->exported = true;
+			envp_invalidate();
+		}
+	} else
+		vars_set(name, "", true);
+}
+
+void
+vars_unset(const char *name) {
+	assert(name);
+
+	var **link = var_find(name, strlen(name));
+	if (!link || !*link)
+		return;
+	var *v = *link;
+	*link = v->next;
+	--vars.count;
+	if (v->exported)
+		envp_invalidate();
+	free(v->entry);
+	free(v);
+}
+
+bool
+vars_valid_name(const char *name, size_t len) {
+	assert(name);
+
+	if (len == 0 || (name[0] >= '0' && name[0] <= '9'))
+		return false;
+	for (size_t i = 0; i < len; ++i) {
+		char c = name[i];
+		if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+			  (c >= '0' && c <= '9')))
+			return false;
+	}
+	return true;
+}
+
+bool
+vars_is_assign(const char *word) {
+	assert(word);
+
+	const char *eq = strchr(word, '=');
+	return eq && vars_valid_name(word, eq - word);
+}
+
+void
+vars_push_temp(char *const *assigns, size_t count) {
+	if (!(vars.frames = realloc(vars.frames,
+								(vars.num_frames + 1) * sizeof *vars.frames)))
+		err(1, "malloc");
+	vars.frames[vars.num_frames++] = vars.num_saved;
+	if (count == 0)
+		return;
+	if (!(vars.saved = realloc(vars.saved,
+							   (vars.num_saved + count) * sizeof *vars.saved)))
+		err(1, "malloc");
+	for (size_t i = 0; i < count; ++i) {
+		size_t name_len = strchr(assigns[i], '=') - assigns[i];
+		saved_var *s = &vars.saved[vars.num_saved++];
+		var **link = var_find(assigns[i], name_len);
+		if (!(s->name = strndup(assigns[i], name_len)))
+			err(1, "malloc");
+		s->entry = NULL;
+		s->exported = false;
+		if (link && *link) {
+			if (!(s->entry = strdup((*link)->entry)))
+				err(1, "malloc");
+			s->exported = (*link)->exported;
+		}
+		vars_assign(assigns[i], true);
+	}
+}
+
+void
+vars_pop_temp() {
+	assert(vars.num_frames > 0);
+
+	size_t start = vars.frames[--vars.num_frames];
+	/* In reverse, so that repeated names end up with the oldest value. */
+	while (vars.num_saved > start) {
+		saved_var *s = &vars.saved[--vars.num_saved];
+		if (s->entry) {
+			var *v = var_put(s->entry, strlen(s->name), false);
+			v->exported = s->exported;
+			envp_invalidate();
+		} else
+			vars_unset(s->name);
+		free(s->name);
+	}
+}
+
+void
+vars_push_args(char *const *args, size_t count) {
+	args_frame *frame = malloc(sizeof *frame);
+	if (!frame || !(frame->args = malloc((count + 1) * sizeof *frame->args)))
+		err(1, "malloc");
+	for (size_t i = 0; i < count; ++i)
+		if (!(frame->args[i] = strdup(args[i])))
+			err(1, "malloc");
+	frame->args[count] = NULL;
+	frame->count = count;
+	frame->outer = vars.args;
+	vars.args = frame;
+}
+
+void
+vars_pop_args() {
+	args_frame *frame = vars.args;
+	assert(frame);
+
+	vars.args = frame->outer;
+	for (size_t i = 0; i < frame->count; ++i)
+		free(frame->args[i]);
+	free(frame->args);
+	free(frame);
+}
+
+char *const *
+vars_args(size_t *count) {
+	assert(count);
+
+	static char *const none[] = {NULL};
+	*count = vars.args ? vars.args->count : 0;
+	return vars.args ? vars.args->args : none;
+}
+
+char **
+vars_envp() {
+	if (vars.envp)
+		return vars.envp;
+	if (!(vars.envp = malloc((vars.count + 1) * sizeof *vars.envp)))
+		err(1, "malloc");
+	size_t count = 0;
+	for (size_t i = 0; i < vars.num_buckets; ++i)
+		for (var *v = vars.buckets[i]; v; v = v->next)
+			if (v->exported)
+				vars.envp[count++] = v->entry;
+	vars.envp[count] = NULL;
+	return vars.envp;
+}
+
+static int
+cmp_entries(const void *l, const void *r) {
+	return strcmp(*(char *const *)l, *(char *const *)r);
+}
+
+void
+vars_print_exported(int fd) {
+	char **envp = vars_envp();
+	size_t count = 0;
+	while (envp[count])
+		++count;
+	char **sorted = malloc((count + 1) * sizeof *sorted);
+	if (!sorted)
+		err(1, "malloc");
+	memcpy(sorted, envp, count * sizeof *sorted);
+	qsort(sorted, count, sizeof *sorted, &cmp_entries);
+	for (size_t i = 0; i < count; ++i)
+		dprintf(fd, "export %s\n", sorted[i]);
+	free(sorted);
+}
@@ -0,0 +1,95 @@
+#ifndef MYSHELL_VARS_HEADER
+#define MYSHELL_VARS_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Shell variables.
+ *
+ * Variables live in a hash table owned by the shell, the process' environ is
+ * only read once at startup. Exported variables form the environment of the
+ * executed commands, its envp array is rebuilt only after an exported
+ * variable changes.
+ * */
+
+/* Imports 'envp' as exported variables. */
+void
+vars_init(char **envp);
+
+/* Removes all variables, e.g. before vars_init() with another environment. */
+void
+vars_clear();
+
+/* Returns value of the variable or NULL if it is not set. */
+const char *
+vars_get(const char *name);
+
+/* Whether 'name' is a set and exported variable. */
+bool
+vars_exported(const char *name);
+
+/* Sets the variable to 'value', it keeps being exported if it was.
+ * 'export' exports it in any case.
+ * */
+void
+vars_set(const char *name, const char *value, bool export);
+
+/* Sets the variable from "NAME=value" string. */
+void
+vars_assign(const char *assign, bool export);
+
+/* Exports the variable, it is created empty if it was not set. */
+void
+vars_export(const char *name);
+
+/* Removes the variable. */
+void
+vars_unset(const char *name);
+
+/* Whether 'name' is a valid variable name. 'len' is its length. */
+bool
+vars_valid_name(const char *name, size_t len);
+
+/* Whether 'word' is a "NAME=value" assignment. */
+bool
+vars_is_assign(const char *word);
+
+/* Sets and exports 'count' "NAME=value" assignments until vars_pop_temp(),
+ * e.g. for a builtin with "VAR=x cmd" prefixes. Calls nest, e.g. for
+ * a builtin in a function.
+ * */
+void
+vars_push_temp(char *const *assigns, size_t count);
+
+/* Restores the variables changed by the last vars_push_temp(). */
+void
+vars_pop_temp();
+
+/* Sets positional parameters $1, $2... to copies of 'count' 'args' until
+ * vars_pop_args(), e.g. for a function call. Calls nest.
+ * */
+void
+vars_push_args(char *const *args, size_t count);
+
+/* Restores the positional parameters of the outer call. */
+void
+vars_pop_args();
+
+/* Returns NULL-terminated positional parameters and puts their number
+ * into *count. Outside of functions there are none.
+ * */
+char *const *
+vars_args(size_t *count);
+
+/* Returns NULL-terminated "NAME=value" array of exported variables. It is
+ * valid until the next change of the variables.
+ * */
+char **
+vars_envp();
+
+/* Prints "export NAME=value" lines of the exported variables into 'fd'
+ * sorted by name.
+ * */
+void
+vars_print_exported(int fd);
+#endif /* ifndef MYSHELL_VARS_HEADER */